@@ -0,0 +1,160 @@
+/*
+ * Benchmark of the cache of the replies with many threads: lookups per sec
+ * with 1 to 64 threads, for a cache with a single lock (1 shard) and for the
+ * sharded one.
+ *
+ * The workload is skewed, as the real traffic: the keys are the URLs of
+ * 100000 queries, 5% of which are looked up 60% of the time, and the cache
+ * holds about a fifth of them. A miss is followed by adding the reply, as a
+ * request would do. All the replies are the same canned one, e.g. with a
+ * single annotated result:
+ *   python3 bench/standin_server.py --results 1 --dump > /tmp/r1.json
+ *   ./bench_cache /tmp/r1.json
+ *
+ * Only the cache is measured, not the parsing of the hits (which runs in
+ * parallel anyway). In order to call the (static) cache functions of the
+ * library, its source is included here.
+ */
+#include <unistd.h>
+#include "../src/ocgeo.c"
+
+#define KEYS 100000
+#define HOT_KEYS (KEYS / 20)
+#define MAX_THREADS 64
+
+static sds keys[KEYS];
+static char* body;
+static size_t body_length;
+static double run_secs = 0.5;
+
+struct worker {
+    pthread_t thread;
+    ocgeo_cache_t* cache;
+    uint64_t rng;
+    long lookups;
+};
+
+static char*
+read_file(const char* path, size_t* length)
+{
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL)
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char* data = malloc(size + 1);
+    if (fread(data, 1, size, fp) != (size_t) size) {
+        free(data);
+        data = NULL;
+    }
+    else {
+        data[size] = '\0';
+        *length = size;
+    }
+    fclose(fp);
+    return data;
+}
+
+/* 60% of the lookups are for the "hot" keys */
+static sds
+next_key(uint64_t* rng)
+{
+    double x = random_uniform(rng);
+    if (x < 0.6)
+        return keys[(int) (x / 0.6 * HOT_KEYS)];
+    return keys[HOT_KEYS + (int) ((x - 0.6) / 0.4 * (KEYS - HOT_KEYS))];
+}
+
+static void*
+worker_run(void* arg)
+{
+    struct worker* w = arg;
+    sds buffer = sdsempty();
+    double end = monotonic_time() + run_secs;
+    while (monotonic_time() < end) {
+        /* Check the time every few lookups only: */
+        for (int i = 0; i < 64; ++i) {
+            sds key = next_key(&w->rng);
+            if (!cache_get(w->cache, key, &buffer))
+                cache_put(w->cache, key, body, body_length);
+        }
+        w->lookups += 64;
+    }
+    sdsfree(buffer);
+    return NULL;
+}
+
+/* Returns the lookups per sec */
+static double
+run(int shards, int threads, ocgeo_cache_stats_t* stats)
+{
+    size_t entry_size = sizeof(struct cache_entry) + sdslen(keys[0]) + body_length;
+    ocgeo_cache_t* cache = ocgeo_cache_new(entry_size * KEYS / 5, shards);
+    /* Warm it up first, with a single thread: */
+    uint64_t rng = random_seed(cache);
+    sds buffer = sdsempty();
+    for (int i = 0; i < KEYS; ++i) {
+        sds key = next_key(&rng);
+        if (!cache_get(cache, key, &buffer))
+            cache_put(cache, key, body, body_length);
+    }
+    sdsfree(buffer);
+
+    struct worker workers[MAX_THREADS];
+    double start = monotonic_time();
+    for (int i = 0; i < threads; ++i) {
+        workers[i].cache = cache;
+        workers[i].rng = random_seed(&workers[i]);
+        workers[i].lookups = 0;
+        pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]);
+    }
+    long lookups = 0;
+    for (int i = 0; i < threads; ++i) {
+        pthread_join(workers[i].thread, NULL);
+        lookups += workers[i].lookups;
+    }
+    double elapsed = monotonic_time() - start;
+    ocgeo_cache_get_stats(cache, stats);
+    ocgeo_cache_free(cache);
+    return lookups / elapsed;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <reply.json> [secs per run]\n", argv[0]);
+        return 1;
+    }
+    body = read_file(argv[1], &body_length);
+    if (body == NULL) {
+        fprintf(stderr, "Cannot read %s\n", argv[1]);
+        return 1;
+    }
+    if (argc > 2)
+        run_secs = atof(argv[2]);
+
+    ocgeo_params_t params = ocgeo_default_params();
+    for (int i = 0; i < KEYS; ++i) {
+        char query[32];
+        snprintf(query, sizeof(query), "%d Main Street", i);
+        keys[i] = build_url(sdsempty(), true, query, "6d0e711d72d74daeb2b0bfd2a5cdfdba", &params);
+    }
+
+    printf("%ld CPUs, %zu bytes per reply, lookups/sec (hit rate):\n",
+        sysconf(_SC_NPROCESSORS_ONLN), body_length);
+    printf("%-8s %22s %22s\n", "threads", "1 shard", "sharded");
+    for (int threads = 1; threads <= MAX_THREADS; threads *= 2) {
+        ocgeo_cache_stats_t single_stats, sharded_stats;
+        double single = run(1, threads, &single_stats);
+        double sharded = run(0, threads, &sharded_stats);
+        printf("%-8d %14.0f (%4.1f%%) %14.0f (%4.1f%%)\n", threads,
+            single, 100.0 * single_stats.hits / (single_stats.hits + single_stats.misses),
+            sharded, 100.0 * sharded_stats.hits / (sharded_stats.hits + sharded_stats.misses));
+    }
+
+    for (int i = 0; i < KEYS; ++i)
+        sdsfree(keys[i]);
+    free(body);
+    return 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * Benchmark of compressed (gzip) vs uncompressed responses: bytes received
+ * and latency per request, using a single client (i.e. one connection).
+ *
+ * Run it against the local stand-in server, replying with e.g. 10 annotated
+ * results per request:
+ *   python3 bench/standin_server.py --port 8089 --results 10 &
+ *   ./bench_compression http://127.0.0.1:8089/geocode/v1/json 500
+ *
+ * Over the loopback interface the transfer itself is almost free, so the
+ * latency mostly shows the cost of (de)compression. For slower links the
+ * time needed to transfer the bytes at the given bandwidth is also shown.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ocgeo.h"
+
+static int
+cmp_double(const void* a, const void* b)
+{
+    double x = *(const double*) a, y = *(const double*) b;
+    return x < y ? -1 : x > y;
+}
+
+static void
+run(const char* server, bool compression, int requests, double mbits)
+{
+    double* latencies = calloc(requests, sizeof(double));
+    double total_latency = 0;
+    long bytes = 0;
+    int count = 0, failed = 0;
+
+    ocgeo_params_t params = ocgeo_default_params();
+    params.api_server = server;
+    params.no_compression = !compression;
+    ocgeo_client_t* client = ocgeo_client_new("bench", &params);
+    for (int i = 0; i < requests; ++i) {
+        ocgeo_response_t response;
+        if (ocgeo_client_forward(client, "Philippistraße 7, Münster", NULL, &response) &&
+            ocgeo_response_ok(&response)) {
+            latencies[count] = response.transfer.total_time * 1000.0;
+            total_latency += latencies[count];
+            bytes += response.transfer.bytes;
+            count++;
+        }
+        else {
+            failed++;
+        }
+        ocgeo_response_cleanup(&response);
+    }
+    ocgeo_client_free(client);
+
+    qsort(latencies, count, sizeof(double), cmp_double);
+    double avg_bytes = count ? (double) bytes / count : 0;
+    printf("%-12s %6d %6d %12.0f %9.3f %9.3f %12.3f\n",
+        compression ? "gzip" : "uncompressed", count, failed, avg_bytes,
+        count ? latencies[count / 2] : 0, count ? total_latency / count : 0,
+        avg_bytes * 8 / (mbits * 1e6) * 1000.0);
+    free(latencies);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <server-url> [requests] [Mbit/s]\n", argv[0]);
+        return 1;
+    }
+    const char* server = argv[1];
+    int requests = argc > 2 ? atoi(argv[2]) : 500;
+    double mbits = argc > 3 ? atof(argv[3]) : 20;
+
+    printf("%d requests per run\n", requests);
+    char wire[32];
+    snprintf(wire, sizeof(wire), "ms @%gMbit/s", mbits);
+    printf("%-12s %6s %6s %12s %9s %9s %12s\n", "", "ok", "failed",
+        "bytes/req", "p50 (ms)", "avg (ms)", wire);
+    run(server, false, requests, mbits);
+    run(server, true, requests, mbits);
+    ocgeo_global_cleanup();
+    return 0;
+}
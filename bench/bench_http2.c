@@ -0,0 +1,101 @@
+/*
+ * Benchmark of the HTTP/2 multiplexed transport of the "batch" API against
+ * the plain HTTP/1.1 one (one connection per request in flight).
+ *
+ * Run it against the local stand-in server, e.g.:
+ *   python3 bench/standin_server.py --port 8089 --delay-ms 20 &
+ *   ./bench_http2 http://127.0.0.1:8089/geocode/v1/json 2000 64
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ocgeo.h"
+
+struct stats {
+    double* latencies;
+    int count;
+    int failed;
+    long connects;
+};
+
+static void
+on_done(bool ok, ocgeo_response_t* response, void* data)
+{
+    struct stats* st = data;
+    if (ok && ocgeo_response_ok(response)) {
+        st->latencies[st->count++] = response->transfer.total_time * 1000.0;
+        st->connects += response->transfer.connects;
+    }
+    else {
+        st->failed++;
+    }
+    ocgeo_response_cleanup(response);
+}
+
+static int
+cmp_double(const void* a, const void* b)
+{
+    double x = *(const double*) a, y = *(const double*) b;
+    return x < y ? -1 : x > y;
+}
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+run(const char* server, bool http2, int requests, int in_flight, int max_streams)
+{
+    struct stats st = {0};
+    st.latencies = calloc(requests, sizeof(double));
+
+    ocgeo_params_t params = ocgeo_default_params();
+    params.api_server = server;
+    ocgeo_batch_t* batch = ocgeo_batch_new("bench", &params, in_flight);
+    /* The stand-in server is a plain "http" one, known to speak HTTP/2: */
+    if (http2 && !(ocgeo_batch_enable_http2(batch, max_streams, 0) && ocgeo_batch_enable_h2c(batch))) {
+        fprintf(stderr, "HTTP/2 is not supported by libcurl\n");
+        exit(1);
+    }
+    for (int i = 0; i < requests; ++i)
+        ocgeo_batch_forward(batch, "Philippistraße 7, Münster", NULL, on_done, &st);
+
+    double start = now_sec();
+    ocgeo_batch_run(batch);
+    double elapsed = now_sec() - start;
+    ocgeo_batch_free(batch);
+
+    qsort(st.latencies, st.count, sizeof(double), cmp_double);
+    double p50 = st.count ? st.latencies[st.count / 2] : 0;
+    double p99 = st.count ? st.latencies[(int) (st.count * 0.99)] : 0;
+    printf("%-8s %8d %6d %11ld %9.2f %9.2f %10.0f\n",
+        http2 ? "HTTP/2" : "HTTP/1.1", st.count, st.failed, st.connects,
+        p50, p99, st.count / elapsed);
+    free(st.latencies);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <server-url> [requests] [in-flight] [max-streams]\n", argv[0]);
+        return 1;
+    }
+    const char* server = argv[1];
+    int requests = argc > 2 ? atoi(argv[2]) : 1000;
+    int in_flight = argc > 3 ? atoi(argv[3]) : 32;
+    int max_streams = argc > 4 ? atoi(argv[4]) : 100;
+
+    printf("%d requests, %d in flight, max %d streams per HTTP/2 connection\n",
+        requests, in_flight, max_streams);
+    printf("%-8s %8s %6s %11s %9s %9s %10s\n",
+        "", "ok", "failed", "connections", "p50 (ms)", "p99 (ms)", "req/sec");
+    run(server, false, requests, in_flight, max_streams);
+    run(server, true, requests, in_flight, max_streams);
+    ocgeo_global_cleanup();
+    return 0;
+}
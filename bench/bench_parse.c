@@ -0,0 +1,270 @@
+/*
+ * Benchmark of parsing the results out of a reply: the single pass over the
+ * members of each object that the library does, against looking up each field
+ * with cJSON_GetObjectItemCaseSensitive (as the library used to do), and the
+ * single pass for only a few fields (see the `fields` parameter).
+ *
+ * It needs a canned reply, e.g. with 100 annotated results:
+ *   python3 bench/standin_server.py --results 100 --dump > /tmp/r100.json
+ *   ./bench_parse /tmp/r100.json
+ *
+ * Build it with optimizations, e.g. `make bench CFLAGS=-O2`
+ *
+ * The time needed for parsing the JSON varies much more than the time needed
+ * for getting the results out of it, so the JSON is parsed once and only the
+ * latter is measured. In order to call the (static) parsing functions of the
+ * library, its source is included here.
+ */
+#include "../src/ocgeo.c"
+
+#define GET_STR(obj,name) (cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(obj,name)))
+#define GET_INT(obj,name) (get_int(cJSON_GetObjectItemCaseSensitive(obj,name)))
+
+static double
+cpu_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+get_int(cJSON* item)
+{
+    return item ? item->valueint : 0;
+}
+
+static char*
+read_file(const char* path)
+{
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL)
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char* data = malloc(size + 1);
+    if (fread(data, 1, size, fp) != (size_t) size) {
+        free(data);
+        data = NULL;
+    }
+    else {
+        data[size] = '\0';
+    }
+    fclose(fp);
+    return data;
+}
+
+static void
+lookup_latlng(cJSON* json, ocgeo_latlng_t* latlng)
+{
+    latlng->lat = cJSON_GetObjectItemCaseSensitive(json, "lat")->valuedouble;
+    latlng->lng = cJSON_GetObjectItemCaseSensitive(json, "lng")->valuedouble;
+}
+
+/* The "field by field" parsing of a result */
+static void
+lookup_result(cJSON* result_js, ocgeo_result_t* result)
+{
+    memset(result, 0, sizeof(ocgeo_result_t));
+    result->confidence = GET_INT(result_js, "confidence");
+    result->formatted = GET_STR(result_js, "formatted");
+    cJSON* bounds_js = cJSON_GetObjectItemCaseSensitive(result_js, "bounds");
+    if (bounds_js) {
+        result->bounds = calloc(1, sizeof(ocgeo_latlng_bounds_t));
+        lookup_latlng(cJSON_GetObjectItem(bounds_js, "northeast"), &result->bounds->northeast);
+        lookup_latlng(cJSON_GetObjectItem(bounds_js, "southwest"), &result->bounds->southwest);
+    }
+    lookup_latlng(cJSON_GetObjectItemCaseSensitive(result_js, "geometry"), &result->geometry);
+
+    cJSON* comp_js = cJSON_GetObjectItemCaseSensitive(result_js, "components");
+    result->ISO_alpha2 = GET_STR(comp_js, "ISO_3166-1_alpha-2");
+    result->ISO_alpha3 = GET_STR(comp_js, "ISO_3166-1_alpha-3");
+    result->type = GET_STR(comp_js, "_type");
+    result->category = GET_STR(comp_js, "_category");
+    result->city = GET_STR(comp_js, "city");
+    result->city_district = GET_STR(comp_js, "city_district");
+    result->continent = GET_STR(comp_js, "continent");
+    result->country = GET_STR(comp_js, "country");
+    result->country_code = GET_STR(comp_js, "country_code");
+    result->county = GET_STR(comp_js, "county");
+    result->house_number = GET_STR(comp_js, "house_number");
+    result->neighbourhood = GET_STR(comp_js, "neighbourhood");
+    result->political_union = GET_STR(comp_js, "political_union");
+    result->postcode = GET_STR(comp_js, "postcode");
+    result->road = GET_STR(comp_js, "road");
+    result->state = GET_STR(comp_js, "state");
+    result->state_district = GET_STR(comp_js, "state_district");
+    result->suburb = GET_STR(comp_js, "suburb");
+
+    cJSON* ann_js = cJSON_GetObjectItemCaseSensitive(result_js, "annotations");
+    if (ann_js == NULL)
+        return;
+    result->callingcode = GET_INT(ann_js, "callingcode");
+    cJSON* tm_ann = cJSON_GetObjectItemCaseSensitive(ann_js, "timezone");
+    if (tm_ann) {
+        result->timezone = calloc(1, sizeof(ocgeo_ann_timezone_t));
+        result->timezone->name = GET_STR(tm_ann, "name");
+        result->timezone->short_name = GET_STR(tm_ann, "short_name");
+        result->timezone->offset_string = GET_STR(tm_ann, "offset_string");
+        result->timezone->offset_sec = GET_INT(tm_ann, "offset_sec");
+        result->timezone->now_in_dst = GET_INT(tm_ann, "now_in_dst") == 1;
+    }
+    cJSON* ri_ann = cJSON_GetObjectItemCaseSensitive(ann_js, "roadinfo");
+    if (ri_ann) {
+        result->roadinfo = calloc(1, sizeof(ocgeo_ann_roadinfo_t));
+        result->roadinfo->drive_on = GET_STR(ri_ann, "drive_on");
+        result->roadinfo->speed_in = GET_STR(ri_ann, "speed_in");
+        result->roadinfo->road = GET_STR(ri_ann, "road");
+        result->roadinfo->road_type = GET_STR(ri_ann, "road_type");
+        result->roadinfo->surface = GET_STR(ri_ann, "surface");
+    }
+    cJSON* cur_ann = cJSON_GetObjectItemCaseSensitive(ann_js, "currency");
+    if (cur_ann) {
+        result->currency = calloc(1, sizeof(ocgeo_ann_currency_t));
+        result->currency->name = GET_STR(cur_ann, "name");
+        result->currency->iso_code = GET_STR(cur_ann, "iso_code");
+        result->currency->symbol = GET_STR(cur_ann, "symbol");
+        result->currency->decimal_mark = GET_STR(cur_ann, "decimal_mark");
+        result->currency->thousands_separator = GET_STR(cur_ann, "thousands_separator");
+    }
+    result->geohash = GET_STR(ann_js, "geohash");
+    cJSON* w3w_ann = cJSON_GetObjectItemCaseSensitive(ann_js, "what3words");
+    if (w3w_ann)
+        result->what3words = GET_STR(w3w_ann, "words");
+}
+
+static void
+free_result(ocgeo_result_t* result)
+{
+    free(result->bounds);
+    free(result->timezone);
+    free(result->roadinfo);
+    free(result->currency);
+}
+
+/* Parse the results with field lookups */
+static void
+lookup_parse(cJSON* results, ocgeo_result_t* parsed)
+{
+    int k = 0;
+    for (cJSON* result_js = results->child; result_js != NULL; result_js = result_js->next, ++k)
+        lookup_result(result_js, parsed + k);
+    for (int i = 0; i < k; ++i)
+        free_result(parsed + i);
+}
+
+/* Parse the results as the library does, with the annotations in an arena */
+static void
+single_pass_parse(cJSON* results, ocgeo_result_t* parsed)
+{
+    struct arena* arena = arena_new(0);
+    int k = 0;
+    for (cJSON* result_js = results->child; result_js != NULL; result_js = result_js->next, ++k) {
+        memset(parsed + k, 0, sizeof(ocgeo_result_t));
+        parse_result(result_js, parsed + k, arena, OCGEO_FIELDS_ALL);
+    }
+    arena_free(arena);
+}
+
+/* Parse only the fields that many applications need */
+#define PROJECTED_FIELDS (OCGEO_FIELD_GEOMETRY | OCGEO_FIELD_FORMATTED | \
+    OCGEO_FIELD_COUNTRY_CODE | OCGEO_FIELD_CONFIDENCE)
+
+static void
+projected_parse(cJSON* results, ocgeo_result_t* parsed)
+{
+    struct arena* arena = arena_new(0);
+    int k = 0;
+    for (cJSON* result_js = results->child; result_js != NULL; result_js = result_js->next, ++k) {
+        memset(parsed + k, 0, sizeof(ocgeo_result_t));
+        parse_result(result_js, parsed + k, arena, PROJECTED_FIELDS);
+    }
+    arena_free(arena);
+}
+
+/* Whether the (optional) annotation `ptr` is missing from both or has the same
+   `field` in both */
+#define SAME_FIELD(a,b,ptr,field) \
+    ((a).ptr == NULL ? (b).ptr == NULL : (b).ptr != NULL && (a).ptr->field == (b).ptr->field)
+
+/* Check that both ways give the same results */
+static bool
+same_results(cJSON* results)
+{
+    bool same = true;
+    for (cJSON* result_js = results->child; result_js != NULL && same; result_js = result_js->next) {
+        ocgeo_result_t a, b;
+        struct arena* arena = arena_new(0);
+        lookup_result(result_js, &a);
+        memset(&b, 0, sizeof(ocgeo_result_t));
+        parse_result(result_js, &b, arena, OCGEO_FIELDS_ALL);
+        same = a.formatted == b.formatted && a.road == b.road && a.ISO_alpha3 == b.ISO_alpha3 &&
+            a.geometry.lat == b.geometry.lat && SAME_FIELD(a, b, bounds, southwest.lng) &&
+            a.confidence == b.confidence && a.callingcode == b.callingcode &&
+            SAME_FIELD(a, b, timezone, offset_sec) &&
+            SAME_FIELD(a, b, currency, thousands_separator) &&
+            a.what3words == b.what3words;
+        free_result(&a);
+        arena_free(arena);
+    }
+    return same;
+}
+
+#define ROUNDS 20
+
+/* Returns the (CPU) time in microsecs per reply, the best of some rounds */
+static double
+run(void (*parse)(cJSON*, ocgeo_result_t*), cJSON* results, ocgeo_result_t* parsed, int iterations)
+{
+    double best = 0;
+    for (int round = 0; round < ROUNDS; ++round) {
+        double start = cpu_time();
+        for (int i = 0; i < iterations; ++i)
+            parse(results, parsed);
+        double elapsed = (cpu_time() - start) / iterations * 1e6;
+        if (round == 0 || elapsed < best)
+            best = elapsed;
+    }
+    return best;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <reply.json> [iterations]\n", argv[0]);
+        return 1;
+    }
+    char* data = read_file(argv[1]);
+    if (data == NULL) {
+        fprintf(stderr, "Cannot read %s\n", argv[1]);
+        return 1;
+    }
+    int iterations = argc > 2 ? atoi(argv[2]) : 200;
+
+    double start = cpu_time();
+    cJSON* json = cJSON_Parse(data);
+    double json_time = (cpu_time() - start) * 1e6;
+    cJSON* results = cJSON_GetObjectItemCaseSensitive(json, "results");
+    int count = cJSON_GetArraySize(results);
+    if (count == 0 || !same_results(results)) {
+        fprintf(stderr, "No results, or they are parsed differently\n");
+        return 1;
+    }
+    ocgeo_result_t* parsed = malloc(count * sizeof(ocgeo_result_t));
+    double lookup = run(lookup_parse, results, parsed, iterations);
+    double single = run(single_pass_parse, results, parsed, iterations);
+    double projected = run(projected_parse, results, parsed, iterations);
+
+    printf("%d results per reply, best of %d x %d iterations, CPU time per reply (us):\n",
+        count, ROUNDS, iterations);
+    printf("%-12s %9.1f (once, for comparison)\n", "cJSON", json_time);
+    printf("%-12s %9.1f\n", "lookups", lookup);
+    printf("%-12s %9.1f\n", "single pass", single);
+    printf("%-12s %9.1f (geometry, formatted, country_code, confidence)\n", "projected", projected);
+    printf("speedup: %.2fx\n", lookup / single);
+    free(parsed);
+    cJSON_Delete(json);
+    free(data);
+    return 0;
+}
@@ -0,0 +1,355 @@
+#!/usr/bin/env python3
+"""
+A local "stand-in" for the OpenCage API server, used by the benchmarks.
+
+It replies to every request with a canned (but realistic, i.e. annotated)
+geocoding response, after an optional artificial delay that simulates the
+server's processing time. It speaks HTTP/1.1 (with keep-alive) and HTTP/2
+over cleartext ("h2c" with prior knowledge) on the same port, so the two
+transports can be compared against the same server. Over HTTP/1.1 the reply
+is gzip compressed if the request has an "Accept-Encoding: gzip" header.
+
+GET /stats returns the number of connections accepted so far. With --dump the
+canned response is printed instead, for the benchmarks that need no server.
+
+For the tests, the path of an HTTP/1.1 request can start with prefixes that
+make the server misbehave (they can be combined, e.g. /flaky/2/delay/50/...):
+  /status/<code>/     reply with that HTTP status code (and an error body)
+  /flaky/<n>/         reply with 503 to the first n requests of the same URL
+                      (or with another status code, e.g. /flaky/1:429/)
+  /delay/<ms>/        delay the reply by that much, instead of --delay-ms
+  /slowfirst/<ms>/    delay the reply to the first request of the same URL
+  /quota/<n>/         report n remaining requests of the quota in the reply
+  /reset/<secs>/      report that the quota is reset after secs (default 3600)
+  /results/<n>/       reply with n results, instead of --results
+  /chunks/<bytes>/    send the body in pieces of that size, pausing after each
+  /corrupt/<offset>/  replace the byte at that offset of the (uncompressed)
+                      body with a '"', so that it's no longer valid JSON
+
+Usage: standin_server.py [--port 8089] [--delay-ms 0] [--results 1] [--dump]
+"""
+import argparse
+import asyncio
+import gzip
+import json
+import re
+import struct
+import time
+
+
+def make_result(i):
+    return {
+        "annotations": {
+            "DMS": {"lat": "51° 57' 10.15320'' N", "lng": "7° 37' 57.26760'' E"},
+            "MGRS": "32ULC0400955996",
+            "Maidenhead": "JO31te17pb",
+            "Mercator": {"x": 849673.052, "y": 6759036.823},
+            "OSM": {
+                "edit_url": "https://www.openstreetmap.org/edit?way=%d#map=16/51.95282/7.63257" % (1000 + i),
+                "note_url": "https://www.openstreetmap.org/note/new#map=16/51.95282/7.63257&layers=N",
+                "url": "https://www.openstreetmap.org/?mlat=51.95282&mlon=7.63257#map=16/51.95282/7.63257",
+            },
+            "UN_M49": {
+                "regions": {"DE": "276", "EUROPE": "150", "WESTERN_EUROPE": "155", "WORLD": "001"},
+                "statistical_groupings": ["MEDC"],
+            },
+            "callingcode": 49,
+            "currency": {
+                "alternate_symbols": [], "decimal_mark": ",", "html_entity": "&#x20AC;",
+                "iso_code": "EUR", "iso_numeric": "978", "name": "Euro",
+                "smallest_denomination": 1, "subunit": "Cent", "subunit_to_unit": 100,
+                "symbol": "€", "symbol_first": 0, "thousands_separator": ".",
+            },
+            "flag": "\U0001f1e9\U0001f1ea",
+            "geohash": "u1jrzv0n0bc3g9%02d" % (i % 100),
+            "qibla": 130.1,
+            "roadinfo": {"drive_on": "right", "road": "Philippistraße",
+                         "road_type": "residential", "speed_in": "km/h"},
+            "sun": {
+                "rise": {"apparent": 1571895360, "astronomical": 1571888580,
+                         "civil": 1571893260, "nautical": 1571890920},
+                "set": {"apparent": 1571931720, "astronomical": 1571938500,
+                        "civil": 1571933820, "nautical": 1571936160},
+            },
+            "timezone": {"name": "Europe/Berlin", "now_in_dst": 1, "offset_sec": 7200,
+                         "offset_string": "+0200", "short_name": "CEST"},
+            "what3words": {"words": "fired.gets.vital"},
+        },
+        "bounds": {
+            "northeast": {"lat": round(51.9528202 + i * 1e-7, 7), "lng": 7.6326628},
+            "southwest": {"lat": 51.9526912, "lng": round(7.6324823 - i * 1e-7, 7)},
+        },
+        "components": {
+            "ISO_3166-1_alpha-2": "DE", "ISO_3166-1_alpha-3": "DEU",
+            "_category": "building", "_type": "building",
+            "city": "Münster", "city_district": "Münster-Mitte",
+            "continent": "Europe", "country": "Germany", "country_code": "de",
+            "county": "Münster", "house_number": str(7 + i),
+            "neighbourhood": "Josef", "political_union": "European Union",
+            "postcode": "48155", "road": "Philippistraße",
+            "state": "North Rhine-Westphalia", "state_code": "NW",
+            "suburb": "Innenstadtring",
+        },
+        "confidence": 10,
+        "formatted": "Philippistraße %d, 48155 Münster, Germany" % (7 + i),
+        "geometry": {"lat": round(51.9527557 + i * 1e-7, 7), "lng": round(7.6325725 - i * 1e-7, 7)},
+    }
+
+
+STATUS_MESSAGES = {200: "OK", 400: "Invalid request", 401: "Unable to authenticate",
+                   403: "Forbidden", 408: "Timeout", 429: "Too many requests",
+                   503: "Internal server error"}
+
+
+def make_response(n, code=200, remaining=2487, reset=1571961600):
+    return json.dumps({
+        "documentation": "https://opencagedata.com/api",
+        "licenses": [{"name": "see attribution guide", "url": "https://opencagedata.com/credits"}],
+        "rate": {"limit": 2500, "remaining": remaining, "reset": reset},
+        "results": [make_result(i) for i in range(n)] if code == 200 else [],
+        "status": {"code": code, "message": STATUS_MESSAGES.get(code, "Error")},
+        "stay_informed": {"blog": "https://blog.opencagedata.com",
+                          "twitter": "https://twitter.com/OpenCage"},
+        "thanks": "For using an OpenCage API",
+        "timestamp": {"created_http": "Thu, 24 Oct 2019 12:00:00 GMT", "created_unix": 1571918400},
+        "total_results": n if code == 200 else 0,
+    }, indent=2, ensure_ascii=False).encode()
+
+
+class Server:
+    def __init__(self, args):
+        self.delay = args.delay_ms / 1000.0
+        self.body = make_response(args.results)
+        self.gzip_body = gzip.compress(self.body, 6)
+        self.results = args.results
+        self.connections = 0
+        self.seen = {}  # the number of requests per URL, for /flaky/ and /slowfirst/
+
+    def reply(self, path, accept_gzip=False):
+        """Returns the status code, body, delay (secs), and size of the pieces
+        to send the body in (0 for all at once) of the reply"""
+        if path.startswith("/stats"):
+            return 200, ("%d\n" % self.connections).encode(), 0, 0
+        seen = self.seen.get(path, 0)
+        self.seen[path] = seen + 1
+        code, delay, remaining, reset = 200, self.delay, None, 3600
+        results, chunk, corrupt = self.results, 0, None
+        while True:
+            m = re.match(r"/(status|flaky|delay|slowfirst|quota|reset|results|chunks|corrupt)"
+                         r"/(\d+)(?::(\d+))?(/.*)", path)
+            if not m:
+                break
+            name, value, path = m.group(1), int(m.group(2)), m.group(4)
+            if name == "status":
+                code = value
+            elif name == "flaky" and seen < value:
+                code = int(m.group(3) or 503)
+            elif name == "delay":
+                delay = value / 1000.0
+            elif name == "slowfirst" and seen == 0:
+                delay = value / 1000.0
+            elif name == "quota":
+                remaining = value
+            elif name == "reset":
+                reset = value
+            elif name == "results":
+                results = value
+            elif name == "chunks":
+                chunk = value
+            elif name == "corrupt":
+                corrupt = value
+        if code == 200 and remaining is None and results == self.results and corrupt is None:
+            body = self.gzip_body if accept_gzip else self.body
+        else:
+            body = make_response(results, code, 2487 if remaining is None else remaining,
+                                 int(time.time()) + reset)
+            if corrupt is not None and corrupt < len(body):
+                body = body[:corrupt] + b'"' + body[corrupt + 1:]
+            if accept_gzip:
+                body = gzip.compress(body, 6)
+        return code, body, delay, chunk
+
+    async def handle(self, reader, writer):
+        self.connections += 1
+        try:
+            data = await reader.read(65536)
+            if data.startswith(H2_PREFACE[:len(data)]) and data:
+                await H2Connection(self, reader, writer).run(data)
+            else:
+                await self.run_h1(reader, writer, data)
+        except (ConnectionError, asyncio.IncompleteReadError):
+            pass
+        finally:
+            writer.close()
+
+    async def run_h1(self, reader, writer, buf):
+        while True:
+            while b"\r\n\r\n" not in buf:
+                more = await reader.read(65536)
+                if not more:
+                    return
+                buf += more
+            head, buf = buf.split(b"\r\n\r\n", 1)
+            lines = head.split(b"\r\n")
+            path = lines[0].split(b" ")[1].decode()
+            accept_gzip = any(line.lower().startswith(b"accept-encoding:") and b"gzip" in line
+                              for line in lines[1:])
+            code, body, delay, chunk = self.reply(path, accept_gzip)
+            if delay > 0:
+                await asyncio.sleep(delay)
+            stats = path.startswith("/stats")
+            encoding = b"Content-Encoding: gzip\r\n" if accept_gzip and not stats else b""
+            reason = STATUS_MESSAGES.get(code, "Error").encode()
+            writer.write(b"HTTP/1.1 %d %s\r\nContent-Type: application/json\r\n" % (code, reason) +
+                         encoding + b"Content-Length: %d\r\n\r\n" % len(body))
+            for offset in range(0, len(body), chunk or len(body) or 1):
+                writer.write(body[offset:offset + (chunk or len(body))])
+                if chunk:
+                    await writer.drain()
+                    await asyncio.sleep(0.001)
+            await writer.drain()
+
+
+H2_PREFACE = b"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+DATA, HEADERS, RST_STREAM, SETTINGS, PING, GOAWAY, WINDOW_UPDATE, CONTINUATION = 0, 1, 3, 4, 6, 7, 8, 9
+END_STREAM, ACK, END_HEADERS = 0x1, 0x1, 0x4
+
+
+def hpack_int(value, prefix_bits, first):
+    limit = (1 << prefix_bits) - 1
+    if value < limit:
+        return bytes([first | value])
+    out = [first | limit]
+    value -= limit
+    while value >= 128:
+        out.append((value & 0x7f) | 0x80)
+        value >>= 7
+    out.append(value)
+    return bytes(out)
+
+
+def hpack_literal(static_index, value):
+    """A "literal header field without indexing", with an indexed name"""
+    value = value.encode()
+    return hpack_int(static_index, 4, 0x00) + hpack_int(len(value), 7, 0x00) + value
+
+
+class H2Connection:
+    """A minimal HTTP/2 server connection. Request headers are never decoded
+    (so HPACK decoding is not needed), every request gets the same reply."""
+
+    def __init__(self, server, reader, writer):
+        self.server = server
+        self.reader = reader
+        self.writer = writer
+        self.conn_window = 65535
+        self.initial_window = 65535
+        self.max_frame = 16384
+        self.windows = {}
+        self.window_changed = asyncio.Event()
+
+    def send(self, ftype, flags, stream, payload=b""):
+        self.writer.write(struct.pack(">I", len(payload))[1:] +
+                          struct.pack(">BBI", ftype, flags, stream) + payload)
+
+    async def run(self, buf):
+        while len(buf) < len(H2_PREFACE):
+            buf += await self.reader.readexactly(len(H2_PREFACE) - len(buf))
+        buf = buf[len(H2_PREFACE):]
+        self.send(SETTINGS, 0, 0, struct.pack(">HI", 3, 1000))  # MAX_CONCURRENT_STREAMS
+        while True:
+            while len(buf) < 9:
+                more = await self.reader.read(65536)
+                if not more:
+                    return
+                buf += more
+            length = struct.unpack(">I", b"\0" + buf[:3])[0]
+            ftype, flags, stream = struct.unpack(">BBI", buf[3:9])
+            stream &= 0x7fffffff
+            while len(buf) < 9 + length:
+                buf += await self.reader.readexactly(9 + length - len(buf))
+            payload, buf = buf[9:9 + length], buf[9 + length:]
+            if not self.on_frame(ftype, flags, stream, payload):
+                return
+            await self.writer.drain()
+
+    def on_frame(self, ftype, flags, stream, payload):
+        if ftype == SETTINGS and not flags & ACK:
+            for k in range(0, len(payload), 6):
+                ident, value = struct.unpack(">HI", payload[k:k + 6])
+                if ident == 4:  # INITIAL_WINDOW_SIZE
+                    for s in self.windows:
+                        self.windows[s] += value - self.initial_window
+                    self.initial_window = value
+                elif ident == 5:  # MAX_FRAME_SIZE
+                    self.max_frame = value
+            self.send(SETTINGS, ACK, 0)
+            self.window_changed.set()
+        elif ftype == PING and not flags & ACK:
+            self.send(PING, ACK, 0, payload)
+        elif ftype == WINDOW_UPDATE:
+            increment = struct.unpack(">I", payload)[0] & 0x7fffffff
+            if stream == 0:
+                self.conn_window += increment
+            elif stream in self.windows:
+                self.windows[stream] += increment
+            self.window_changed.set()
+        elif ftype in (HEADERS, CONTINUATION) and flags & END_HEADERS:
+            # We assume there's no request body, i.e. a GET
+            self.windows[stream] = self.initial_window
+            asyncio.ensure_future(self.respond(stream))
+        elif ftype == RST_STREAM:
+            self.windows.pop(stream, None)
+        elif ftype == GOAWAY:
+            return False
+        return True
+
+    async def respond(self, stream):
+        _, body, delay, _ = self.server.reply("/")
+        if delay > 0:
+            await asyncio.sleep(delay)
+        if stream not in self.windows:
+            return
+        headers = (b"\x88" +  # :status 200
+                   hpack_literal(31, "application/json") +  # content-type
+                   hpack_literal(28, str(len(body))))  # content-length
+        self.send(HEADERS, END_HEADERS, stream, headers)
+        offset = 0
+        while offset < len(body):
+            window = min(self.conn_window, self.windows.get(stream, 0), self.max_frame)
+            if window <= 0:
+                if stream not in self.windows:
+                    return
+                self.window_changed.clear()
+                await self.window_changed.wait()
+                continue
+            chunk = body[offset:offset + window]
+            offset += len(chunk)
+            self.conn_window -= len(chunk)
+            self.windows[stream] -= len(chunk)
+            self.send(DATA, END_STREAM if offset == len(body) else 0, stream, chunk)
+            await self.writer.drain()
+        self.windows.pop(stream, None)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[1])
+    parser.add_argument("--port", type=int, default=8089)
+    parser.add_argument("--delay-ms", type=float, default=0)
+    parser.add_argument("--results", type=int, default=1)
+    parser.add_argument("--dump", action="store_true")
+    args = parser.parse_args()
+    if args.dump:
+        print(make_response(args.results).decode())
+        return
+    server = Server(args)
+
+    async def serve():
+        srv = await asyncio.start_server(server.handle, "127.0.0.1", args.port)
+        async with srv:
+            await srv.serve_forever()
+    asyncio.run(serve())
+
+
+if __name__ == "__main__":
+    main()
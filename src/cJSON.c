@@ -43,6 +43,7 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <ctype.h>
+#include <float.h>
 
 #ifdef ENABLE_LOCALES
 #include <locale.h>
@@ -262,8 +263,47 @@ typedef struct
     size_t offset;
     size_t depth; /* How deeply nested (in arrays/objects) is the input at the current offset. */
     internal_hooks hooks;
+    const cJSON_Allocator *allocator; /* if not NULL, used instead of the hooks, see cJSON_ParseWithAllocator */
 } parse_buffer;
 
+/* Allocate memory while parsing */
+static void *parse_allocate(const parse_buffer * const buffer, size_t size)
+{
+    if (buffer->allocator != NULL)
+    {
+        return buffer->allocator->allocate(buffer->allocator->context, size);
+    }
+    return buffer->hooks.allocate(size);
+}
+
+/* Memory given by an allocator is never freed by cJSON, its owner releases it all at once */
+static void parse_deallocate(const parse_buffer * const buffer, void *pointer)
+{
+    if (buffer->allocator == NULL)
+    {
+        buffer->hooks.deallocate(pointer);
+    }
+}
+
+static cJSON *parse_new_item(const parse_buffer * const buffer)
+{
+    cJSON* node = (cJSON*)parse_allocate(buffer, sizeof(cJSON));
+    if (node)
+    {
+        memset(node, '\0', sizeof(cJSON));
+    }
+
+    return node;
+}
+
+static void parse_delete(const parse_buffer * const buffer, cJSON *item)
+{
+    if (buffer->allocator == NULL)
+    {
+        cJSON_Delete(item);
+    }
+}
+
 /* check if the given size is left to read in a given parse buffer (starting with 1) */
 #define can_read(buffer, size) ((buffer != NULL) && (((buffer)->offset + size) <= (buffer)->length))
 /* check if the buffer can be accessed at the given index (starting with 0) */
@@ -272,13 +312,135 @@ typedef struct
 /* get a pointer to the buffer at the position */
 #define buffer_at_offset(buffer) ((buffer)->content + (buffer)->offset)
 
+/* The fast path below needs double arithmetic without extra precision (i.e. no x87) */
+#if defined(FLT_EVAL_METHOD) && (FLT_EVAL_METHOD == 0)
+#define CJSON_FAST_NUMBERS 1
+#endif
+
+#ifdef CJSON_FAST_NUMBERS
+static const double exact_powers_of_ten[] =
+{
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define is_digit(c) (((c) >= '0') && ((c) <= '9'))
+
+/* Parse a plain decimal number ("-?[0-9]+(.[0-9]+)?([eE][+-]?[0-9]+)?") without
+ * strtod and independently of the locale. This is only done when the result is
+ * exact, i.e. the same as strtod's: when the digits (without the decimal point)
+ * form an integer of at most 2^53 and it's multiplied or divided by a power of ten
+ * up to 10^22, both the operands are exact doubles, so the result of the single
+ * operation is correctly rounded (Clinger's fast path). Coordinates and most other
+ * numbers in responses are like that. Otherwise it returns false and strtod is used. */
+static cJSON_bool parse_fast_number(const parse_buffer * const input_buffer, double *number, size_t *length)
+{
+    const unsigned char *start = buffer_at_offset(input_buffer);
+    size_t available = input_buffer->length - input_buffer->offset;
+    size_t i = 0;
+    unsigned long long mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    cJSON_bool negative = false;
+    double value = 0;
+
+    if (available > 63)
+    {
+        available = 63; /* the length that is given to strtod */
+    }
+
+    if ((i < available) && (start[i] == '-'))
+    {
+        negative = true;
+        i++;
+    }
+    if ((i == available) || !is_digit(start[i]))
+    {
+        return false;
+    }
+    for (; (i < available) && is_digit(start[i]); i++)
+    {
+        /* leading zeros are not significant digits */
+        if (((mantissa != 0) || (start[i] != '0')) && (++digits > 19))
+        {
+            return false;
+        }
+        mantissa = mantissa * 10 + (unsigned long long)(start[i] - '0');
+    }
+    if ((i < available) && (start[i] == '.'))
+    {
+        i++;
+        if ((i == available) || !is_digit(start[i]))
+        {
+            return false;
+        }
+        for (; (i < available) && is_digit(start[i]); i++)
+        {
+            if (((mantissa != 0) || (start[i] != '0')) && (++digits > 19))
+            {
+                return false;
+            }
+            mantissa = mantissa * 10 + (unsigned long long)(start[i] - '0');
+            exponent--;
+        }
+    }
+    if ((i < available) && ((start[i] == 'e') || (start[i] == 'E')))
+    {
+        cJSON_bool negative_exponent = false;
+        int explicit_exponent = 0;
+        i++;
+        if ((i < available) && ((start[i] == '+') || (start[i] == '-')))
+        {
+            negative_exponent = start[i] == '-';
+            i++;
+        }
+        if ((i == available) || !is_digit(start[i]))
+        {
+            return false;
+        }
+        for (; (i < available) && is_digit(start[i]); i++)
+        {
+            if (explicit_exponent > 1000)
+            {
+                return false;
+            }
+            explicit_exponent = explicit_exponent * 10 + (start[i] - '0');
+        }
+        exponent += negative_exponent ? -explicit_exponent : explicit_exponent;
+    }
+    /* anything else that strtod could have taken as part of the number is left to it */
+    if ((i == available) || (start[i] == '.') || (start[i] == 'e') || (start[i] == 'E') ||
+        (start[i] == '+') || (start[i] == '-') || is_digit(start[i]))
+    {
+        return false;
+    }
+
+    if ((mantissa > (1ULL << 53)) || (exponent < -22) || (exponent > 22))
+    {
+        return false;
+    }
+    value = (double)mantissa;
+    if (exponent < 0)
+    {
+        value /= exact_powers_of_ten[-exponent];
+    }
+    else
+    {
+        value *= exact_powers_of_ten[exponent];
+    }
+    *number = negative ? -value : value;
+    *length = i;
+    return true;
+}
+#endif /* CJSON_FAST_NUMBERS */
+
 /* Parse the input text to generate a number, and populate the result into item. */
 static cJSON_bool parse_number(cJSON * const item, parse_buffer * const input_buffer)
 {
     double number = 0;
     unsigned char *after_end = NULL;
     unsigned char number_c_string[64];
-    unsigned char decimal_point = get_decimal_point();
+    unsigned char decimal_point = 0;
     size_t i = 0;
 
     if ((input_buffer == NULL) || (input_buffer->content == NULL))
@@ -286,6 +448,15 @@ static cJSON_bool parse_number(cJSON * const item, parse_buffer * const input_bu
         return false;
     }
 
+#ifdef CJSON_FAST_NUMBERS
+    if (parse_fast_number(input_buffer, &number, &i))
+    {
+        input_buffer->offset += i;
+        goto number_end;
+    }
+#endif
+    decimal_point = get_decimal_point();
+
     /* copy the number into a temporary buffer and replace '.' with the decimal point
      * of the current locale (for strtod)
      * This also takes care of '\0' not necessarily being available for marking the end of the input */
@@ -326,7 +497,11 @@ loop_end:
     {
         return false; /* parse_error */
     }
+    input_buffer->offset += (size_t)(after_end - number_c_string);
 
+#ifdef CJSON_FAST_NUMBERS
+number_end:
+#endif
     item->valuedouble = number;
 
     /* use saturation in case of overflow */
@@ -345,7 +520,6 @@ loop_end:
 
     item->type = cJSON_Number;
 
-    input_buffer->offset += (size_t)(after_end - number_c_string);
     return true;
 }
 
@@ -744,7 +918,7 @@ static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_bu
 
         /* This is at most how much we need for the output */
         allocation_length = (size_t) (input_end - buffer_at_offset(input_buffer)) - skipped_bytes;
-        output = (unsigned char*)input_buffer->hooks.allocate(allocation_length + sizeof(""));
+        output = (unsigned char*)parse_allocate(input_buffer, allocation_length + sizeof(""));
         if (output == NULL)
         {
             goto fail; /* allocation failure */
@@ -822,7 +996,7 @@ static cJSON_bool parse_string(cJSON * const item, parse_buffer * const input_bu
 fail:
     if (output != NULL)
     {
-        input_buffer->hooks.deallocate(output);
+        parse_deallocate(input_buffer, output);
     }
 
     if (input_pointer != NULL)
@@ -1006,15 +1180,15 @@ static parse_buffer *skip_utf8_bom(parse_buffer * const buffer)
     return buffer;
 }
 
-/* Parse an object - create a new root, and populate. */
-CJSON_PUBLIC(cJSON *) cJSON_ParseWithOpts(const char *value, const char **return_parse_end, cJSON_bool require_null_terminated)
+/* Parse an object - create a new root, and populate. On failure the position of the error is returned
+ * in error_position (and in return_parse_end, if given). */
+static cJSON *parse(const char *value, const char **return_parse_end, cJSON_bool require_null_terminated, const cJSON_Allocator *allocator, error *error_position)
 {
-    parse_buffer buffer = { 0, 0, 0, 0, { 0, 0, 0 } };
+    parse_buffer buffer = { 0, 0, 0, 0, { 0, 0, 0 }, NULL };
     cJSON *item = NULL;
 
-    /* reset error position */
-    global_error.json = NULL;
-    global_error.position = 0;
+    error_position->json = NULL;
+    error_position->position = 0;
 
     if (value == NULL)
     {
@@ -1025,8 +1199,9 @@ CJSON_PUBLIC(cJSON *) cJSON_ParseWithOpts(const char *value, const char **return
     buffer.length = strlen((const char*)value) + sizeof("");
     buffer.offset = 0;
     buffer.hooks = global_hooks;
+    buffer.allocator = allocator;
 
-    item = cJSON_New_Item(&global_hooks);
+    item = parse_new_item(&buffer);
     if (item == NULL) /* memory fail */
     {
         goto fail;
@@ -1057,7 +1232,7 @@ CJSON_PUBLIC(cJSON *) cJSON_ParseWithOpts(const char *value, const char **return
 fail:
     if (item != NULL)
     {
-        cJSON_Delete(item);
+        parse_delete(&buffer, item);
     }
 
     if (value != NULL)
@@ -1080,12 +1255,28 @@ fail:
             *return_parse_end = (const char*)local_error.json + local_error.position;
         }
 
-        global_error = local_error;
+        *error_position = local_error;
     }
 
     return NULL;
 }
 
+CJSON_PUBLIC(cJSON *) cJSON_ParseWithOpts(const char *value, const char **return_parse_end, cJSON_bool require_null_terminated)
+{
+    error local_error;
+    cJSON *item = parse(value, return_parse_end, require_null_terminated, NULL, &local_error);
+
+    /* reset error position, or set it */
+    global_error = local_error;
+    return item;
+}
+
+CJSON_PUBLIC(cJSON *) cJSON_ParseWithAllocator(const char *value, const char **return_parse_end, const cJSON_Allocator *allocator)
+{
+    error local_error;
+    return parse(value, return_parse_end, false, allocator, &local_error);
+}
+
 /* Default options for cJSON_Parse */
 CJSON_PUBLIC(cJSON *) cJSON_Parse(const char *value)
 {
@@ -1386,7 +1577,7 @@ static cJSON_bool parse_array(cJSON * const item, parse_buffer * const input_buf
     do
     {
         /* allocate next item */
-        cJSON *new_item = cJSON_New_Item(&(input_buffer->hooks));
+        cJSON *new_item = parse_new_item(input_buffer);
         if (new_item == NULL)
         {
             goto fail; /* allocation failure */
@@ -1435,7 +1626,7 @@ success:
 fail:
     if (head != NULL)
     {
-        cJSON_Delete(head);
+        parse_delete(input_buffer, head);
     }
 
     return false;
@@ -1540,7 +1731,7 @@ static cJSON_bool parse_object(cJSON * const item, parse_buffer * const input_bu
     do
     {
         /* allocate next item */
-        cJSON *new_item = cJSON_New_Item(&(input_buffer->hooks));
+        cJSON *new_item = parse_new_item(input_buffer);
         if (new_item == NULL)
         {
             goto fail; /* allocation failure */
@@ -1606,7 +1797,7 @@ success:
 fail:
     if (head != NULL)
     {
-        cJSON_Delete(head);
+        parse_delete(input_buffer, head);
     }
 
     return false;
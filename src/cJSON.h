@@ -131,6 +131,13 @@ typedef struct cJSON_Hooks
 
 typedef int cJSON_bool;
 
+/* An allocator with a context (e.g. an "arena"), see cJSON_ParseWithAllocator */
+typedef struct cJSON_Allocator
+{
+    void *(CJSON_CDECL *allocate)(void *context, size_t size);
+    void *context;
+} cJSON_Allocator;
+
 /* Limits how deeply nested arrays/objects can be before cJSON rejects to parse them.
  * This is to prevent stack overflows. */
 #ifndef CJSON_NESTING_LIMIT
@@ -149,6 +156,10 @@ CJSON_PUBLIC(cJSON *) cJSON_Parse(const char *value);
 /* ParseWithOpts allows you to require (and check) that the JSON is null terminated, and to retrieve the pointer to the final byte parsed. */
 /* If you supply a ptr in return_parse_end and parsing fails, then return_parse_end will contain a pointer to the error so will match cJSON_GetErrorPtr(). */
 CJSON_PUBLIC(cJSON *) cJSON_ParseWithOpts(const char *value, const char **return_parse_end, cJSON_bool require_null_terminated);
+/* ParseWithAllocator gets all the memory needed from the given allocator, and never frees it: the result must not be
+ * given to cJSON_Delete, the owner of the allocator should release all the memory at once. It does not affect
+ * cJSON_GetErrorPtr, so it's thread safe; if parsing fails return_parse_end (if given) points to the error. */
+CJSON_PUBLIC(cJSON *) cJSON_ParseWithAllocator(const char *value, const char **return_parse_end, const cJSON_Allocator *allocator);
 
 /* Render a cJSON entity to text for transfer/storage. */
 CJSON_PUBLIC(char *) cJSON_Print(const cJSON *item);
@@ -0,0 +1,39 @@
+/*
+ * Compacts a disk cache of the replies (see `ocgeo_disk_cache_open`), keeping
+ * only the valid replies in its index, optionally with a new size.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "ocgeo.h"
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: compact_cache <path> [max-megabytes]\n");
+        return 1;
+    }
+    const char* path = argv[1];
+    size_t max_bytes = argc > 2 ? (size_t) atol(argv[2]) * 1024 * 1024 : 0;
+
+    ocgeo_cache_stats_t before, after;
+    ocgeo_disk_cache_t* dc = ocgeo_disk_cache_open(path, 0);
+    if (dc == NULL) {
+        fprintf(stderr, "Cannot open the cache at %s\n", path);
+        return 1;
+    }
+    ocgeo_disk_cache_get_stats(dc, &before);
+    ocgeo_disk_cache_close(dc);
+
+    if (!ocgeo_disk_cache_compact(path, max_bytes)) {
+        fprintf(stderr, "Compacting the cache at %s failed\n", path);
+        return 1;
+    }
+    dc = ocgeo_disk_cache_open(path, 0);
+    if (dc == NULL)
+        return 1;
+    ocgeo_disk_cache_get_stats(dc, &after);
+    ocgeo_disk_cache_close(dc);
+    printf("%zu replies in %zu bytes, was %zu replies in %zu bytes\n",
+        after.entries, after.bytes, before.entries, before.bytes);
+    return 0;
+}
@@ -24,8 +24,19 @@
 #include <stdlib.h>
 #include <curl/curl.h>
 #include <string.h>
+#include <strings.h>
 #include <assert.h>
 #include <time.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "cJSON.h"
 #include "sds.h"
@@ -35,6 +46,16 @@
 #define OCG_API_SERVER "https://api.opencagedata.com/geocode/v1/json"
 #endif
 
+/* Receive buffers larger than this are not kept for reuse: */
+#ifndef OCGEO_MAX_RETAINED_BUFFER
+#define OCGEO_MAX_RETAINED_BUFFER (1024*1024)
+#endif
+
+/* The max size of the buffer reserved in advance, based on Content-Length: */
+#ifndef OCGEO_MAX_BODY_RESERVE
+#define OCGEO_MAX_BODY_RESERVE (64*1024*1024)
+#endif
+
 #ifndef OCGEO_VERSION
 #define OCGEO_VERSION "0.3.2"
 #endif
@@ -50,266 +71,3271 @@ char* ocgeo_version = OCGEO_VERSION;
 
 static ocgeo_latlng_t ocgeo_invalid_point = {.lat = -91.0, .lng=-181};
 
+struct stream_parser;
+static void stream_scan(struct stream_parser* s, sds data);
+
 struct http_response {
     sds data;
+    /* Not NULL if the body is parsed while received, see `stream_scan` */
+    struct stream_parser* stream;
+};
+
+static size_t
+write_callback(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    struct http_response* r = userdata;
+    r->data = sdscatlen(r->data, ptr, size*nmemb);
+    if (r->stream)
+        stream_scan(r->stream, r->data);
+    return nmemb;
+}
+
+/* Reserve the buffer for the body in advance, based on the Content-Length
+   header, instead of growing it while the body is received. For compressed
+   bodies this is less than the actual size, but still a good start. */
+static size_t
+header_callback(char* buffer, size_t size, size_t nitems, void* userdata)
+{
+    static const char name[] = "content-length:";
+    const size_t name_len = sizeof(name) - 1;
+    struct http_response* r = userdata;
+    size_t len = size * nitems;
+    /* When parsing while receiving, the buffer only holds a part of the body */
+    if (r->stream != NULL || len <= name_len || strncasecmp(buffer, name, name_len) != 0)
+        return len;
+
+    size_t length = 0;
+    for (size_t i = name_len; i < len; ++i) {
+        if (buffer[i] >= '0' && buffer[i] <= '9')
+            length = 10 * length + (buffer[i] - '0');
+        else if (buffer[i] != ' ' && buffer[i] != '\t')
+            break;
+        if (length > OCGEO_MAX_BODY_RESERVE)
+            return len;
+    }
+    size_t used = sdslen(r->data);
+    if (length > used && length - used > sdsavail(r->data))
+        r->data = sdsMakeRoomFor(r->data, length - used);
+    return len;
+}
+
+/* Prepare a retained buffer for reuse, or drop it if it got too large */
+static sds
+recycle_buffer(sds buffer)
+{
+    if (buffer == NULL || sdsAllocSize(buffer) > OCGEO_MAX_RETAINED_BUFFER) {
+        sdsfree(buffer);
+        return sdsempty();
+    }
+    sdsclear(buffer);
+    return buffer;
+}
+
+/*
+ * A simple "bump" allocator: all the memory of a response (the parsed JSON,
+ * the results, and their annotations) is allocated from an "arena" that is
+ * freed at once. The arena itself lives at the start of its first block.
+ */
+#ifndef OCGEO_ARENA_MIN_BLOCK
+#define OCGEO_ARENA_MIN_BLOCK (16*1024)
+#endif
+
+#define ARENA_ALIGN sizeof(union { void* p; double d; long long l; })
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+struct arena_block {
+    struct arena_block* next;
+    size_t size;
+    size_t used;
+};
+#define ARENA_BLOCK_HEADER ARENA_ROUND(sizeof(struct arena_block))
+
+struct arena {
+    struct arena_block* blocks; /* the most recent first */
+    size_t capacity; /* the total size of the blocks */
+};
+
+static struct arena_block*
+arena_new_block(size_t size)
+{
+    struct arena_block* block = malloc(ARENA_BLOCK_HEADER + size);
+    if (block == NULL)
+        return NULL;
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+/* Create an arena, with room for exactly `size` bytes in its first block */
+static struct arena*
+arena_new_exact(size_t size)
+{
+    size += ARENA_ROUND(sizeof(struct arena));
+    struct arena_block* block = arena_new_block(size);
+    if (block == NULL)
+        return NULL;
+    struct arena* arena = (struct arena*) ((char*) block + ARENA_BLOCK_HEADER);
+    block->used = ARENA_ROUND(sizeof(struct arena));
+    arena->blocks = block;
+    arena->capacity = size;
+    return arena;
+}
+
+/* Create an arena, with room for at least `size` bytes in its first block */
+static struct arena*
+arena_new(size_t size)
+{
+    if (size < OCGEO_ARENA_MIN_BLOCK)
+        size = OCGEO_ARENA_MIN_BLOCK;
+    return arena_new_exact(size);
+}
+
+static void*
+arena_alloc(struct arena* arena, size_t size)
+{
+    size = ARENA_ROUND(size);
+    struct arena_block* block = arena->blocks;
+    if (block->size - block->used < size) {
+        /* Each new block doubles the capacity: */
+        size_t block_size = arena->capacity > size ? arena->capacity : size;
+        block = arena_new_block(block_size);
+        if (block == NULL)
+            return NULL;
+        block->next = arena->blocks;
+        arena->blocks = block;
+        arena->capacity += block_size;
+    }
+    void* ptr = (char*) block + ARENA_BLOCK_HEADER + block->used;
+    block->used += size;
+    return ptr;
+}
+
+static void*
+arena_calloc(struct arena* arena, size_t size)
+{
+    void* ptr = arena_alloc(arena, size);
+    if (ptr != NULL)
+        memset(ptr, 0, size);
+    return ptr;
+}
+
+static void
+arena_free(struct arena* arena)
+{
+    if (arena == NULL)
+        return;
+    /* The arena is in its first block, i.e. the last in the list */
+    struct arena_block* block = arena->blocks;
+    while (block != NULL) {
+        struct arena_block* next = block->next;
+        free(block);
+        block = next;
+    }
+}
+
+/* Was the memory at `ptr` allocated from the arena? */
+static bool
+arena_contains(struct arena* arena, const void* ptr)
+{
+    if (arena == NULL)
+        return false;
+    uintptr_t p = (uintptr_t) ptr;
+    for (struct arena_block* block = arena->blocks; block != NULL; block = block->next) {
+        uintptr_t start = (uintptr_t) block + ARENA_BLOCK_HEADER;
+        if (p >= start && p < start + block->used)
+            return true;
+    }
+    return false;
+}
+
+/* Arenas larger than this are not kept for reuse: */
+#ifndef OCGEO_MAX_RETAINED_ARENA
+#define OCGEO_MAX_RETAINED_ARENA (8*1024*1024)
+#endif
+
+/* Release all the allocations, keeping the memory for reuse. If the arena had
+   to grow, its blocks are replaced by a single one with the same capacity.
+   Returns the arena, which may have moved, or NULL if it's not kept. */
+static struct arena*
+arena_reset(struct arena* arena)
+{
+    if (arena == NULL)
+        return NULL;
+    size_t capacity = arena->capacity;
+    struct arena_block* block = arena->blocks;
+    if (block->next == NULL) {
+        block->used = ARENA_ROUND(sizeof(struct arena));
+        return arena;
+    }
+    arena_free(arena);
+    if (capacity > OCGEO_MAX_RETAINED_ARENA)
+        return NULL;
+    return arena_new(capacity - ARENA_ROUND(sizeof(struct arena)));
+}
+
+/* The allocator used by cJSON, see `cJSON_ParseWithAllocator` */
+static void*
+json_arena_alloc(void* context, size_t size)
+{
+    return arena_alloc(context, size);
+}
+
+#define JSON_INT_VALUE(json) ((json) == NULL || cJSON_IsNull(json) ? 0 : (json)->valueint)
+#define JSON_OBJ_GET_STR(obj,name) (cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(obj,name)))
+
+/*
+ * The objects of each result are parsed in a single pass over their members,
+ * dispatching on the key, instead of looking up each field (which is a linear
+ * scan over the members).
+ */
+
+/* Compare a (NUL terminated) key with a string literal, when the length of
+   the key is already known to be equal to the literal's one: */
+#define KEY_IS(key,lit) ((key)[0] == (lit)[0] && memcmp((key), (lit), sizeof(lit) - 1) == 0)
+
+static inline void
+parse_latlng(cJSON* json, ocgeo_latlng_t* latlng)
+{
+    for (cJSON* item = json->child; item != NULL; item = item->next) {
+        const char* key = item->string;
+        if (strcmp(key, "lat") == 0)
+            latlng->lat = item->valuedouble;
+        else if (strcmp(key, "lng") == 0)
+            latlng->lng = item->valuedouble;
+    }
+}
+
+/* The field of the result for a component, if it's selected in `fields` */
+#define COMPONENT(name, bit) ((fields & (bit)) ? &result->name : NULL)
+
+/* Returns the field of the result that corresponds to the given key of the
+   "components", or NULL if it's not one of the ones we keep */
+static char**
+component_field(ocgeo_result_t* result, const char* key, unsigned fields)
+{
+    switch (strlen(key)) {
+    case 4:
+        if (KEY_IS(key, "city")) return COMPONENT(city, OCGEO_FIELD_CITY);
+        if (KEY_IS(key, "road")) return COMPONENT(road, OCGEO_FIELD_ROAD);
+        break;
+    case 5:
+        if (KEY_IS(key, "_type")) return COMPONENT(type, OCGEO_FIELD_TYPE);
+        if (KEY_IS(key, "state")) return COMPONENT(state, OCGEO_FIELD_STATE);
+        break;
+    case 6:
+        if (KEY_IS(key, "county")) return COMPONENT(county, OCGEO_FIELD_COUNTY);
+        if (KEY_IS(key, "suburb")) return COMPONENT(suburb, OCGEO_FIELD_SUBURB);
+        break;
+    case 7:
+        if (KEY_IS(key, "country")) return COMPONENT(country, OCGEO_FIELD_COUNTRY);
+        break;
+    case 8:
+        if (KEY_IS(key, "postcode")) return COMPONENT(postcode, OCGEO_FIELD_POSTCODE);
+        break;
+    case 9:
+        if (KEY_IS(key, "_category")) return COMPONENT(category, OCGEO_FIELD_CATEGORY);
+        if (KEY_IS(key, "continent")) return COMPONENT(continent, OCGEO_FIELD_CONTINENT);
+        break;
+    case 12:
+        if (KEY_IS(key, "country_code")) return COMPONENT(country_code, OCGEO_FIELD_COUNTRY_CODE);
+        if (KEY_IS(key, "house_number")) return COMPONENT(house_number, OCGEO_FIELD_HOUSE_NUMBER);
+        break;
+    case 13:
+        if (KEY_IS(key, "city_district")) return COMPONENT(city_district, OCGEO_FIELD_CITY_DISTRICT);
+        if (KEY_IS(key, "neighbourhood")) return COMPONENT(neighbourhood, OCGEO_FIELD_NEIGHBOURHOOD);
+        break;
+    case 14:
+        if (KEY_IS(key, "state_district")) return COMPONENT(state_district, OCGEO_FIELD_STATE_DISTRICT);
+        break;
+    case 15:
+        if (KEY_IS(key, "political_union")) return COMPONENT(political_union, OCGEO_FIELD_POLITICAL_UNION);
+        break;
+    case 18:
+        if (KEY_IS(key, "ISO_3166-1_alpha-2")) return COMPONENT(ISO_alpha2, OCGEO_FIELD_ISO_ALPHA2);
+        if (KEY_IS(key, "ISO_3166-1_alpha-3")) return COMPONENT(ISO_alpha3, OCGEO_FIELD_ISO_ALPHA3);
+        break;
+    }
+    return NULL;
+}
+
+static void
+parse_components(cJSON* json, ocgeo_result_t* result, unsigned fields)
+{
+    for (cJSON* item = json->child; item != NULL; item = item->next) {
+        char** field = component_field(result, item->string, fields);
+        if (field)
+            *field = cJSON_GetStringValue(item);
+    }
+}
+
+static ocgeo_ann_timezone_t*
+parse_timezone(cJSON* json, struct arena* arena)
+{
+    ocgeo_ann_timezone_t* timezone = arena_calloc(arena, sizeof(ocgeo_ann_timezone_t));
+    if (timezone == NULL)
+        return NULL;
+    for (cJSON* item = json->child; item != NULL; item = item->next) {
+        const char* key = item->string;
+        switch (strlen(key)) {
+        case 4:
+            if (KEY_IS(key, "name")) timezone->name = cJSON_GetStringValue(item);
+            break;
+        case 10:
+            if (KEY_IS(key, "short_name")) timezone->short_name = cJSON_GetStringValue(item);
+            else if (KEY_IS(key, "offset_sec")) timezone->offset_sec = JSON_INT_VALUE(item);
+            else if (KEY_IS(key, "now_in_dst")) timezone->now_in_dst = JSON_INT_VALUE(item) == 1;
+            break;
+        case 13:
+            if (KEY_IS(key, "offset_string")) timezone->offset_string = cJSON_GetStringValue(item);
+            break;
+        }
+    }
+    return timezone;
+}
+
+static ocgeo_ann_roadinfo_t*
+parse_roadinfo(cJSON* json, struct arena* arena)
+{
+    ocgeo_ann_roadinfo_t* roadinfo = arena_calloc(arena, sizeof(ocgeo_ann_roadinfo_t));
+    if (roadinfo == NULL)
+        return NULL;
+    for (cJSON* item = json->child; item != NULL; item = item->next) {
+        const char* key = item->string;
+        switch (strlen(key)) {
+        case 4:
+            if (KEY_IS(key, "road")) roadinfo->road = cJSON_GetStringValue(item);
+            break;
+        case 7:
+            if (KEY_IS(key, "surface")) roadinfo->surface = cJSON_GetStringValue(item);
+            break;
+        case 8:
+            if (KEY_IS(key, "drive_on")) roadinfo->drive_on = cJSON_GetStringValue(item);
+            else if (KEY_IS(key, "speed_in")) roadinfo->speed_in = cJSON_GetStringValue(item);
+            break;
+        case 9:
+            if (KEY_IS(key, "road_type")) roadinfo->road_type = cJSON_GetStringValue(item);
+            break;
+        }
+    }
+    return roadinfo;
+}
+
+static ocgeo_ann_currency_t*
+parse_currency(cJSON* json, struct arena* arena)
+{
+    ocgeo_ann_currency_t* currency = arena_calloc(arena, sizeof(ocgeo_ann_currency_t));
+    if (currency == NULL)
+        return NULL;
+    for (cJSON* item = json->child; item != NULL; item = item->next) {
+        const char* key = item->string;
+        switch (strlen(key)) {
+        case 4:
+            if (KEY_IS(key, "name")) currency->name = cJSON_GetStringValue(item);
+            break;
+        case 6:
+            if (KEY_IS(key, "symbol")) currency->symbol = cJSON_GetStringValue(item);
+            break;
+        case 8:
+            if (KEY_IS(key, "iso_code")) currency->iso_code = cJSON_GetStringValue(item);
+            break;
+        case 12:
+            if (KEY_IS(key, "decimal_mark")) currency->decimal_mark = cJSON_GetStringValue(item);
+            break;
+        case 19:
+            if (KEY_IS(key, "thousands_separator")) currency->thousands_separator = cJSON_GetStringValue(item);
+            break;
+        }
+    }
+    return currency;
+}
+
+static void
+parse_annotations(cJSON* json, ocgeo_result_t* result, struct arena* arena, unsigned fields)
+{
+    for (cJSON* item = json->child; item != NULL; item = item->next) {
+        const char* key = item->string;
+        switch (strlen(key)) {
+        case 7:
+            if ((fields & OCGEO_FIELD_GEOHASH) && KEY_IS(key, "geohash"))
+                result->geohash = cJSON_GetStringValue(item);
+            break;
+        case 8:
+            if (!cJSON_IsObject(item))
+                break;
+            if ((fields & OCGEO_FIELD_TIMEZONE) && KEY_IS(key, "timezone"))
+                result->timezone = parse_timezone(item, arena);
+            else if ((fields & OCGEO_FIELD_ROADINFO) && KEY_IS(key, "roadinfo"))
+                result->roadinfo = parse_roadinfo(item, arena);
+            else if ((fields & OCGEO_FIELD_CURRENCY) && KEY_IS(key, "currency"))
+                result->currency = parse_currency(item, arena);
+            break;
+        case 10:
+            if ((fields & OCGEO_FIELD_WHAT3WORDS) && KEY_IS(key, "what3words"))
+                result->what3words = JSON_OBJ_GET_STR(item, "words");
+            break;
+        case 11:
+            if ((fields & OCGEO_FIELD_CALLINGCODE) && KEY_IS(key, "callingcode"))
+                result->callingcode = JSON_INT_VALUE(item);
+            break;
+        }
+    }
+}
+
+/* Parse the `fields` (see OCGEO_FIELD_*) of the result */
+static void
+parse_result(cJSON* json, ocgeo_result_t* result, struct arena* arena, unsigned fields)
+{
+    bool has_geometry = false;
+    for (cJSON* item = json->child; item != NULL; item = item->next) {
+        const char* key = item->string;
+        switch (strlen(key)) {
+        case 6:
+            if ((fields & OCGEO_FIELD_BOUNDS) && KEY_IS(key, "bounds") && cJSON_IsObject(item) &&
+                (result->bounds = arena_calloc(arena, sizeof(ocgeo_latlng_bounds_t))) != NULL) {
+                for (cJSON* corner = item->child; corner != NULL; corner = corner->next) {
+                    if (strcmp(corner->string, "northeast") == 0)
+                        parse_latlng(corner, &result->bounds->northeast);
+                    else if (strcmp(corner->string, "southwest") == 0)
+                        parse_latlng(corner, &result->bounds->southwest);
+                }
+            }
+            break;
+        case 8:
+            if ((fields & OCGEO_FIELD_GEOMETRY) && KEY_IS(key, "geometry") && cJSON_IsObject(item)) {
+                parse_latlng(item, &result->geometry);
+                has_geometry = true;
+            }
+            break;
+        case 9:
+            if ((fields & OCGEO_FIELD_FORMATTED) && KEY_IS(key, "formatted"))
+                result->formatted = cJSON_GetStringValue(item);
+            break;
+        case 10:
+            if ((fields & OCGEO_FIELD_CONFIDENCE) && KEY_IS(key, "confidence"))
+                result->confidence = JSON_INT_VALUE(item);
+            else if ((fields & OCGEO_FIELDS_COMPONENTS) && KEY_IS(key, "components"))
+                parse_components(item, result, fields);
+            break;
+        case 11:
+            if ((fields & OCGEO_FIELDS_ANNOTATIONS) && KEY_IS(key, "annotations"))
+                parse_annotations(item, result, arena, fields);
+            break;
+        }
+    }
+    if (!has_geometry)
+        result->geometry = ocgeo_invalid_point;
+}
+
+/* Parse the members of the reply except the results. Returns false if it's
+   not a reply of the API, i.e. there's no status code. */
+static bool
+parse_response_status(cJSON* json, ocgeo_response_t* response)
+{
+    cJSON* obj = NULL;
+
+    obj = cJSON_GetObjectItemCaseSensitive(json, "status");
+    cJSON* code = cJSON_GetObjectItemCaseSensitive(obj, "code");
+    if (!cJSON_IsNumber(code))
+        return false;
+    response->status.code = code->valueint;
+    response->status.message = JSON_OBJ_GET_STR(obj,"message");
+
+    /* Rate information, may not returned (e.g. for paying customers): */
+    obj = cJSON_GetObjectItem(json, "rate");
+    if (obj) {
+        response->rateInfo.limit = JSON_INT_VALUE(cJSON_GetObjectItemCaseSensitive(obj, "limit"));
+        response->rateInfo.remaining = JSON_INT_VALUE(cJSON_GetObjectItemCaseSensitive(obj, "remaining"));
+        response->rateInfo.reset = JSON_INT_VALUE(cJSON_GetObjectItemCaseSensitive(obj, "reset"));
+    }
+
+    obj = cJSON_GetObjectItem(json, "total_results");
+    response->total_results = JSON_INT_VALUE(obj);
+    return true;
+}
+
+static void
+set_error(ocgeo_response_t* response, int stage, int code, long offset)
+{
+    response->error.stage = stage;
+    response->error.code = code;
+    response->error.offset = offset;
+}
+
+/* Returns 0 if ok, -1 if the memory could not be allocated, or -2 if it's not
+   a reply of the API (the error of the response is set in both cases) */
+static int
+parse_response_json(cJSON* json, ocgeo_response_t* response, struct arena* arena, unsigned fields)
+{
+    cJSON* obj = NULL;
+
+    response->results = NULL;
+    response->internal = arena;
+
+    if (!parse_response_status(json, response)) {
+        set_error(response, OCGEO_ERROR_SCHEMA, 0, 0);
+        return -2;
+    }
+    if (response->total_results <= 0) {
+        response->total_results = 0;
+        return 0;
+    }
+
+    obj = cJSON_GetObjectItemCaseSensitive(json, "results");
+    if (!cJSON_IsArray(obj)) {
+        response->total_results = 0;
+        set_error(response, OCGEO_ERROR_SCHEMA, 0, 0);
+        return -2;
+    }
+    response->results = arena_alloc(arena, response->total_results * sizeof(ocgeo_result_t));
+    if (response->results == NULL) {
+        /* Not to be taken for a reply with no results: */
+        response->total_results = 0;
+        response->status.code = 0;
+        response->status.message = NULL;
+        set_error(response, OCGEO_ERROR_MEMORY, 0, 0);
+        return -1;
+    }
+
+    cJSON* result_js;
+    int k = 0;
+    ocgeo_result_t proto = {0};
+    for (result_js = obj->child; result_js!= NULL && k < response->total_results; result_js = result_js->next, k++) {
+        ocgeo_result_t* result = response->results + k;
+        *result = proto; /* initialize with 0/NULL values */
+        result->internal = result_js;
+        parse_result(result_js, result, arena, fields);
+    }
+    response->total_results = k;
+    return 0;
+}
+
+/* The size of the arena needed for a reply of the given length: the parsed
+   JSON takes about 4 times the size of the (compact) JSON text, so that one
+   block is usually enough */
+#define ARENA_SIZE_FOR_REPLY(length) ((length) * 9 / 2)
+
+/* Parse a JSON reply into the response, with the given `fields` of the
+   results. Returns the parsed JSON, or NULL if the reply is not valid JSON,
+   not a reply of the API, or there's no memory for it (and then the error of
+   the response is set). */
+static cJSON*
+parse_reply(const char* body, size_t length, ocgeo_response_t* response, unsigned fields)
+{
+    /* An (empty) arena may have been kept, see `ocgeo_response_reset` */
+    struct arena* arena = response->internal;
+    if (arena == NULL)
+        arena = response->internal = arena_new(ARENA_SIZE_FOR_REPLY(length));
+    if (arena == NULL) {
+        set_error(response, OCGEO_ERROR_MEMORY, 0, 0);
+        return NULL;
+    }
+    cJSON_Allocator allocator = {json_arena_alloc, arena};
+    const char* end = NULL;
+    cJSON* json = cJSON_ParseWithAllocator(body, &end, &allocator);
+    if (json == NULL) {
+        set_error(response, OCGEO_ERROR_PARSE, 0, end ? (long) (end - body) : 0);
+        return NULL;
+    }
+    if (parse_response_json(json, response, arena, fields) < 0)
+        return NULL;
+    return json;
+}
+
+/*
+ * Incremental parsing: the body is scanned while it is received, and each
+ * element of the "results" array is parsed as soon as it is complete. Its text
+ * is then removed from the buffer, which therefore holds at most one result
+ * at any time. What is left at the end, i.e. the reply with an empty "results"
+ * array, is parsed by `stream_finish`.
+ */
+enum stream_state {
+    STREAM_TOP,         /* in the top level object */
+    STREAM_RESULTS_KEY, /* after "results": */
+    STREAM_RESULTS,     /* in the "results" array */
+    STREAM_DONE         /* after the "results", or an error */
+};
+
+struct stream_parser {
+    ocgeo_response_t* response;
+    unsigned fields;
+    enum stream_state state;
+    bool failed;
+    bool out_of_memory; /* the failure was an allocation, not invalid JSON */
+    /* The scanner's state, at `scanned` bytes into the buffer: */
+    size_t scanned;
+    int depth;
+    bool in_string;
+    bool escaped;
+    size_t key_start; /* of the last string in the top level object */
+    size_t key_end;
+    size_t array_start; /* after the '[' of "results" */
+    size_t element_start; /* of the result being received */
+    size_t removed; /* bytes cut out of the buffer so far */
+    bool results_cut; /* the "results" array was received in full */
+    long error_offset; /* in the body, if a result is not valid JSON */
+    /* The parsed results, allocated from the response's arena: */
+    ocgeo_result_t* results;
+    int count;
+    int capacity;
+};
+
+static bool
+stream_init(struct stream_parser* s, ocgeo_response_t* response, unsigned fields)
+{
+    memset(s, 0, sizeof(struct stream_parser));
+    if (response->internal == NULL)
+        response->internal = arena_new(0);
+    s->response = response;
+    s->fields = fields;
+    return response->internal != NULL;
+}
+
+/* The allocator used by cJSON for the stream, noting if an allocation failed */
+static void*
+stream_json_alloc(void* context, size_t size)
+{
+    struct stream_parser* s = context;
+    void* p = arena_alloc(s->response->internal, size);
+    if (p == NULL)
+        s->out_of_memory = true;
+    return p;
+}
+
+/* Parse the (complete) result at [`element_start`, `end`) of the buffer */
+static bool
+stream_add_result(struct stream_parser* s, sds data, size_t end)
+{
+    struct arena* arena = s->response->internal;
+    if (s->count == s->capacity) {
+        int capacity = s->capacity ? 2 * s->capacity : 8;
+        ocgeo_result_t* results = arena_alloc(arena, capacity * sizeof(ocgeo_result_t));
+        if (results == NULL) {
+            s->out_of_memory = true;
+            return false;
+        }
+        if (s->count > 0)
+            memcpy(results, s->results, s->count * sizeof(ocgeo_result_t));
+        s->results = results;
+        s->capacity = capacity;
+    }
+
+    cJSON_Allocator allocator = {stream_json_alloc, s};
+    char saved = data[end];
+    data[end] = '\0';
+    const char* parse_end = NULL;
+    cJSON* json = cJSON_ParseWithAllocator(data + s->element_start, &parse_end, &allocator);
+    data[end] = saved;
+    if (json == NULL) {
+        s->error_offset = (long) (s->removed + (parse_end ? (size_t) (parse_end - data) : s->element_start));
+        return false;
+    }
+
+    ocgeo_result_t* result = s->results + s->count++;
+    memset(result, 0, sizeof(ocgeo_result_t));
+    result->internal = json;
+    parse_result(json, result, arena, s->fields);
+    return true;
+}
+
+/* Remove [`start`, `end`) from the buffer */
+static void
+stream_cut(struct stream_parser* s, sds data, size_t start, size_t end)
+{
+    memmove(data + start, data + end, sdslen(data) - end);
+    sdsIncrLen(data, -(int) (end - start));
+    s->removed += end - start;
+}
+
+/* The characters that `stream_scan` needs to look at, outside of strings */
+static const bool stream_special[256] = {
+    ['"'] = true, [':'] = true, ['{'] = true, ['}'] = true, ['['] = true, [']'] = true
+};
+
+static void
+stream_scan(struct stream_parser* s, sds data)
+{
+    size_t len = sdslen(data);
+    size_t i = s->scanned;
+    while (i < len && s->state != STREAM_DONE) {
+        if (s->in_string) {
+            if (s->escaped) {
+                s->escaped = false;
+                i++;
+            }
+            while (i < len && data[i] != '"' && data[i] != '\\')
+                i++;
+            if (i == len)
+                break;
+            if (data[i] == '\\')
+                s->escaped = true;
+            else {
+                s->in_string = false;
+                if (s->depth == 1)
+                    s->key_end = i;
+            }
+            i++;
+            continue;
+        }
+        if (s->state == STREAM_RESULTS_KEY) {
+            while (i < len && (data[i] == ' ' || data[i] == '\t' || data[i] == '\r' || data[i] == '\n'))
+                i++;
+            if (i == len)
+                break;
+            s->state = data[i] == '[' ? STREAM_RESULTS : STREAM_TOP;
+            s->array_start = i + 1;
+        }
+        while (i < len && !stream_special[(unsigned char) data[i]])
+            i++;
+        if (i == len)
+            break;
+        char c = data[i];
+        switch (c) {
+        case '"':
+            s->in_string = true;
+            if (s->depth == 1)
+                s->key_start = i + 1;
+            break;
+        case ':':
+            if (s->depth == 1 && s->key_end - s->key_start == 7 &&
+                memcmp(data + s->key_start, "results", 7) == 0)
+                s->state = STREAM_RESULTS_KEY;
+            break;
+        case '{':
+        case '[':
+            if (++s->depth == 3 && s->state == STREAM_RESULTS && c == '{')
+                s->element_start = i;
+            break;
+        case '}':
+        case ']':
+            s->depth--;
+            if (s->state != STREAM_RESULTS)
+                break;
+            if (s->depth == 2 && c == '}') {
+                if (!stream_add_result(s, data, i + 1)) {
+                    s->failed = true;
+                    s->state = STREAM_DONE;
+                    break;
+                }
+                stream_cut(s, data, s->element_start, i + 1);
+                len = sdslen(data);
+                i = s->element_start;
+                continue;
+            }
+            if (s->depth == 1) {
+                /* What's left in the array are the commas between the results,
+                   unless the reply is not valid JSON (see `stream_finish`) */
+                size_t k = s->array_start;
+                while (k < i && (data[k] == ',' || data[k] == ' ' || data[k] == '\t' ||
+                                 data[k] == '\r' || data[k] == '\n'))
+                    k++;
+                if (k == i) {
+                    stream_cut(s, data, s->array_start, i);
+                    len = sdslen(data);
+                    i = s->array_start;
+                    s->results_cut = true;
+                }
+                s->state = STREAM_DONE;
+            }
+            break;
+        }
+        i++;
+    }
+    s->scanned = i;
+}
+
+/* Parse what is left of the body after `stream_scan`, and add the results
+   parsed so far. Returns the parsed JSON, or NULL if the reply is invalid. */
+static cJSON*
+stream_finish(struct stream_parser* s, sds data)
+{
+    ocgeo_response_t* response = s->response;
+    struct arena* arena = response->internal;
+    if (s->failed) {
+        if (s->out_of_memory)
+            set_error(response, OCGEO_ERROR_MEMORY, 0, 0);
+        else
+            set_error(response, OCGEO_ERROR_PARSE, 0, s->error_offset);
+        return NULL;
+    }
+    cJSON_Allocator allocator = {stream_json_alloc, s};
+    const char* end = NULL;
+    cJSON* json = cJSON_ParseWithAllocator(data, &end, &allocator);
+    if (json == NULL && s->out_of_memory) {
+        set_error(response, OCGEO_ERROR_MEMORY, 0, 0);
+        return NULL;
+    }
+    if (json == NULL) {
+        /* The offset in the body, before cutting the results out of it: */
+        size_t offset = end ? (size_t) (end - data) : 0;
+        if (s->count > 0 && !s->results_cut) {
+            /* A result was not valid JSON (and the scanner lost track of it),
+               and what's in its place are the commas after the ones parsed */
+            size_t k = s->array_start;
+            while (data[k] == ',' || data[k] == ' ' || data[k] == '\t' || data[k] == '\r' || data[k] == '\n')
+                k++;
+            const char* element_end = NULL;
+            if (cJSON_ParseWithAllocator(data + k, &element_end, &allocator) == NULL && element_end)
+                offset = (size_t) (element_end - data);
+        }
+        if (offset >= s->array_start)
+            offset += s->removed;
+        set_error(response, OCGEO_ERROR_PARSE, 0, (long) offset);
+        return NULL;
+    }
+    if (s->count == 0)
+        return parse_response_json(json, response, arena, s->fields) < 0 ? NULL : json;
+
+    if (!parse_response_status(json, response)) {
+        set_error(response, OCGEO_ERROR_SCHEMA, 0, 0);
+        return NULL;
+    }
+    if (response->total_results > s->count)
+        response->total_results = s->count;
+    if (response->total_results <= 0) {
+        response->total_results = 0;
+        return json;
+    }
+    response->results = s->results;
+    /* Put the results back in the JSON tree: */
+    cJSON* results_js = cJSON_GetObjectItemCaseSensitive(json, "results");
+    if (results_js != NULL && results_js->child == NULL) {
+        cJSON* prev = NULL;
+        for (int k = 0; k < response->total_results; ++k) {
+            cJSON* item = response->results[k].internal;
+            item->prev = prev;
+            if (prev)
+                prev->next = item;
+            else
+                results_js->child = item;
+            prev = item;
+        }
+        results_js->child->prev = prev;
+    }
+    return json;
+}
+
+static double
+monotonic_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+sleep_for(double secs)
+{
+    if (secs <= 0)
+        return;
+    struct timespec ts;
+    ts.tv_sec = (time_t) secs;
+    ts.tv_nsec = (long) ((secs - ts.tv_sec) * 1e9);
+    while (nanosleep(&ts, &ts) != 0)
+        ;
+}
+
+/*
+ * Client side rate limiter: a "token bucket" that is refilled with
+ * `rate` tokens per second, up to `burst` tokens, combined with the API's
+ * (e.g. daily) quota as reported in the "rate" field of the responses.
+ */
+struct ocgeo_rate_limiter {
+    pthread_mutex_t lock;
+    double rate;
+    double burst;
+    double tokens;
+    double last_refill;
+
+    /* Quota info, from the responses. Valid if `quota_known` */
+    bool quota_known;
+    int remaining;
+    int reset;
+};
+
+enum rate_limit_result {
+    RATE_LIMIT_ACQUIRED,
+    RATE_LIMIT_WAIT, /* no token available yet */
+    RATE_LIMIT_EXHAUSTED /* the quota has been exhausted */
+};
+
+/* Try to take a token. If there's none available `wait` is set to the seconds
+   until there's one. If `reserve` is true, the token is taken anyway (and the
+   caller should wait before using it). */
+static enum rate_limit_result
+rate_limiter_take(ocgeo_rate_limiter_t* rl, bool reserve, double* wait)
+{
+    enum rate_limit_result result = RATE_LIMIT_ACQUIRED;
+    *wait = 0;
+
+    pthread_mutex_lock(&rl->lock);
+    if (rl->quota_known) {
+        if (time(NULL) >= rl->reset)
+            rl->quota_known = false; /* a new period has started */
+        else if (rl->remaining <= 0)
+            result = RATE_LIMIT_EXHAUSTED;
+    }
+    if (result == RATE_LIMIT_ACQUIRED && rl->rate > 0) {
+        double now = monotonic_time();
+        rl->tokens += (now - rl->last_refill) * rl->rate;
+        if (rl->tokens > rl->burst)
+            rl->tokens = rl->burst;
+        rl->last_refill = now;
+        if (rl->tokens < 1.0) {
+            *wait = (1.0 - rl->tokens) / rl->rate;
+            if (!reserve)
+                result = RATE_LIMIT_WAIT;
+        }
+        if (result == RATE_LIMIT_ACQUIRED)
+            rl->tokens -= 1.0;
+    }
+    if (result == RATE_LIMIT_ACQUIRED && rl->quota_known)
+        rl->remaining--;
+    pthread_mutex_unlock(&rl->lock);
+    return result;
+}
+
+/* The server replied with 429 (too many requests): slow down */
+static void
+rate_limiter_penalize(ocgeo_rate_limiter_t* rl)
+{
+    pthread_mutex_lock(&rl->lock);
+    if (rl->tokens > 0)
+        rl->tokens = 0;
+    pthread_mutex_unlock(&rl->lock);
+}
+
+ocgeo_rate_limiter_t* ocgeo_rate_limiter_new(double requests_per_sec, int burst)
+{
+    ocgeo_rate_limiter_t* rl = calloc(1, sizeof(ocgeo_rate_limiter_t));
+    if (rl == NULL)
+        return NULL;
+    pthread_mutex_init(&rl->lock, NULL);
+    rl->rate = requests_per_sec;
+    rl->burst = burst < 1 ? 1 : burst;
+    rl->tokens = rl->burst;
+    rl->last_refill = monotonic_time();
+    return rl;
+}
+
+void ocgeo_rate_limiter_free(ocgeo_rate_limiter_t* rl)
+{
+    if (rl == NULL)
+        return;
+    pthread_mutex_destroy(&rl->lock);
+    free(rl);
+}
+
+bool ocgeo_rate_limiter_acquire(ocgeo_rate_limiter_t* rl, bool block)
+{
+    if (rl == NULL)
+        return true;
+    double wait;
+    enum rate_limit_result result = rate_limiter_take(rl, block, &wait);
+    if (result == RATE_LIMIT_ACQUIRED)
+        sleep_for(wait);
+    return result == RATE_LIMIT_ACQUIRED;
+}
+
+void ocgeo_rate_limiter_update(ocgeo_rate_limiter_t* rl, const ocgeo_rate_info_t* info)
+{
+    if (rl == NULL || info == NULL || info->limit <= 0)
+        return;
+    pthread_mutex_lock(&rl->lock);
+    /* Requests still in flight have already been subtracted from our estimate
+       but not from the server's, so in the same period keep the lowest: */
+    if (!rl->quota_known || rl->reset != info->reset || info->remaining < rl->remaining)
+        rl->remaining = info->remaining;
+    rl->reset = info->reset;
+    rl->quota_known = true;
+    pthread_mutex_unlock(&rl->lock);
+}
+
+static void
+set_local_status(ocgeo_response_t* response, int code)
+{
+    response->status.code = code;
+    switch (code) {
+    case OCGEO_CODE_RATE_LIMITED:
+        response->status.message = "Request not sent, rate limited by the client";
+        break;
+    case OCGEO_CODE_DEADLINE_EXCEEDED:
+        response->status.message = "Request timed out";
+        break;
+    default:
+        response->status.message = NULL;
+    }
+}
+
+/* Feed the rate limiter (if any) with the outcome of a request */
+static void
+rate_limiter_feedback(ocgeo_params_t* params, ocgeo_response_t* response)
+{
+    if (params->rate_limiter == NULL)
+        return;
+    ocgeo_rate_limiter_update(params->rate_limiter, &response->rateInfo);
+    if (response->status.code == OCGEO_CODE_MANY_REQUESTS)
+        rate_limiter_penalize(params->rate_limiter);
+}
+
+/*
+ * Retries, with "full jitter" exponential backoff, see
+ * https://aws.amazon.com/blogs/architecture/exponential-backoff-and-jitter/
+ */
+static uint64_t
+random_seed(const void* p)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_nsec << 32) ^ (uint64_t) ts.tv_sec ^ (uint64_t) (uintptr_t) p;
+}
+
+/* Uniformly distributed random number in [0, 1), using xorshift64* */
+static double
+random_uniform(uint64_t* state)
+{
+    uint64_t x = *state ? *state : 0x9E3779B97F4A7C15ULL;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return ((x * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* The status of the response, or the HTTP status if the body could not be
+   parsed (e.g. a 503 from a proxy) */
+static int
+response_status(ocgeo_response_t* response)
+{
+    return response->status.code != 0 ? response->status.code : response->transfer.http_status;
+}
+
+/* Return the delay (in secs) before the next attempt, or a negative number if
+   the request should not be retried. */
+static double
+retry_delay(ocgeo_retry_policy_t* policy, int attempts, double elapsed,
+            ocgeo_response_t* response, uint64_t* rng)
+{
+    if (attempts >= policy->max_attempts)
+        return -1;
+    int code = response_status(response);
+    if (code != OCGEO_CODE_TIMEOUT && code != OCGEO_CODE_MANY_REQUESTS &&
+        code != OCGEO_CODE_INTERNAL_ERROR)
+        return -1;
+
+    double cap = policy->max_delay_ms / 1000.0;
+    double backoff = policy->base_delay_ms / 1000.0;
+    for (int i = 1; i < attempts && (cap <= 0 || backoff < cap); ++i)
+        backoff *= 2;
+    if (cap > 0 && backoff > cap)
+        backoff = cap;
+    double delay = backoff * random_uniform(rng);
+
+    /* If the quota has been exhausted, there's no point in retrying before
+       it's reset, and we don't wait more than the max delay (if any, else
+       the deadline below limits the wait) */
+    ocgeo_rate_info_t* rate = &response->rateInfo;
+    if (code == OCGEO_CODE_MANY_REQUESTS && rate->limit > 0 && rate->remaining <= 0) {
+        double until_reset = (double) rate->reset - (double) time(NULL);
+        if (until_reset > 0) {
+            if (cap > 0 && until_reset > cap)
+                return -1;
+            delay += until_reset;
+        }
+    }
+
+    if (policy->deadline_ms > 0 && (elapsed + delay) * 1000 > policy->deadline_ms)
+        return -1;
+    return delay;
+}
+
+/*
+ * A process wide table of "interned" strings: the values of the fields that
+ * have a few distinct values (countries, currencies, timezones, etc.) are kept
+ * here once, and the results point to them instead of their own copies, see
+ * `intern_results`. The strings are never freed, until `ocgeo_global_cleanup`.
+ */
+#ifndef OCGEO_MAX_INTERNED
+#define OCGEO_MAX_INTERNED (64*1024)
+#endif
+
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+    const char** slots; /* open addressing, with linear probing */
+    size_t capacity; /* a power of 2 */
+    size_t count;
+    struct arena* strings;
+} intern_table;
+
+static uint64_t
+hash_string(const char* str, size_t len)
+{
+    /* FNV-1a */
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (unsigned char) str[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static bool
+intern_grow(void)
+{
+    size_t capacity = intern_table.capacity ? 2 * intern_table.capacity : 1024;
+    const char** slots = calloc(capacity, sizeof(const char*));
+    if (slots == NULL)
+        return false;
+    for (size_t i = 0; i < intern_table.capacity; ++i) {
+        const char* str = intern_table.slots[i];
+        if (str == NULL)
+            continue;
+        size_t k = hash_string(str, strlen(str)) & (capacity - 1);
+        while (slots[k] != NULL)
+            k = (k + 1) & (capacity - 1);
+        slots[k] = str;
+    }
+    free(intern_table.slots);
+    intern_table.slots = slots;
+    intern_table.capacity = capacity;
+    return true;
+}
+
+/* Returns the interned copy of the string, which is added if it's not there,
+   or NULL if the table is full. The lock should be held. */
+static const char*
+intern_locked(const char* str)
+{
+    size_t len = strlen(str);
+    uint64_t hash = hash_string(str, len);
+    if (intern_table.capacity > 0) {
+        size_t k = hash & (intern_table.capacity - 1);
+        for (const char* slot; (slot = intern_table.slots[k]) != NULL;
+             k = (k + 1) & (intern_table.capacity - 1)) {
+            if (strcmp(slot, str) == 0)
+                return slot;
+        }
+    }
+    if (intern_table.count >= OCGEO_MAX_INTERNED)
+        return NULL;
+
+    /* Keep the load factor under 1/2: */
+    if (2 * (intern_table.count + 1) > intern_table.capacity && !intern_grow())
+        return NULL;
+    if (intern_table.strings == NULL && (intern_table.strings = arena_new(0)) == NULL)
+        return NULL;
+    char* copy = arena_alloc(intern_table.strings, len + 1);
+    if (copy == NULL)
+        return NULL;
+    memcpy(copy, str, len + 1);
+    size_t k = hash & (intern_table.capacity - 1);
+    while (intern_table.slots[k] != NULL)
+        k = (k + 1) & (intern_table.capacity - 1);
+    intern_table.slots[k] = copy;
+    intern_table.count++;
+    return copy;
+}
+
+const char* ocgeo_intern(const char* str)
+{
+    if (str == NULL)
+        return NULL;
+    pthread_mutex_lock(&intern_lock);
+    const char* interned = intern_locked(str);
+    pthread_mutex_unlock(&intern_lock);
+    return interned;
+}
+
+/* Is the string one of the interned ones? The lock should be held. */
+static bool
+is_interned_locked(const char* str)
+{
+    return str != NULL && arena_contains(intern_table.strings, str);
+}
+
+#define INTERNED_MAX_FIELDS 20
+
+/* Collect the fields of the result that are interned, returns their number */
+static int
+interned_fields(ocgeo_result_t* r, char** fields[INTERNED_MAX_FIELDS])
+{
+    char** own[] = {
+        &r->ISO_alpha2, &r->ISO_alpha3, &r->type, &r->category, &r->continent,
+        &r->country, &r->country_code, &r->political_union
+    };
+    int n = sizeof(own) / sizeof(own[0]);
+    memcpy(fields, own, sizeof(own));
+    if (r->timezone) {
+        fields[n++] = &r->timezone->name;
+        fields[n++] = &r->timezone->short_name;
+        fields[n++] = &r->timezone->offset_string;
+    }
+    if (r->roadinfo) {
+        fields[n++] = &r->roadinfo->drive_on;
+        fields[n++] = &r->roadinfo->speed_in;
+    }
+    if (r->currency) {
+        fields[n++] = &r->currency->name;
+        fields[n++] = &r->currency->iso_code;
+        fields[n++] = &r->currency->symbol;
+        fields[n++] = &r->currency->decimal_mark;
+        fields[n++] = &r->currency->thousands_separator;
+    }
+    return n;
+}
+
+/* Point the low cardinality fields of the results to interned strings */
+static void
+intern_results(ocgeo_response_t* response)
+{
+    char** fields[INTERNED_MAX_FIELDS];
+    pthread_mutex_lock(&intern_lock);
+    for (int k = 0; k < response->total_results; ++k) {
+        int n = interned_fields(response->results + k, fields);
+        for (int i = 0; i < n; ++i) {
+            const char* interned = *fields[i] ? intern_locked(*fields[i]) : NULL;
+            if (interned != NULL)
+                *fields[i] = (char*) interned;
+        }
+    }
+    pthread_mutex_unlock(&intern_lock);
+}
+
+static void
+intern_cleanup(void)
+{
+    pthread_mutex_lock(&intern_lock);
+    free(intern_table.slots);
+    arena_free(intern_table.strings);
+    memset(&intern_table, 0, sizeof(intern_table));
+    pthread_mutex_unlock(&intern_lock);
+}
+
+/*
+ * The cache of the replies. The key is the URL of the request, which has the
+ * query and all the parameters that are sent to the server in a fixed order,
+ * and the value is the body of the reply. A hit is parsed into the response
+ * as if it was received: each response owns its memory as usual, and the
+ * options applied while parsing (e.g. `fields` or `compact`) are not part of
+ * the key.
+ * The cache is split into "shards", selected by the hash of the key, each
+ * with its own lock and a part of the size limit, so that many threads
+ * rarely wait for each other. In each shard the entries are in a hash table
+ * with chaining, and in a list ordered by their last use, for evicting the
+ * least recently used ones. A reply larger than the part of its shard is not
+ * kept, so by default a small cache gets fewer shards, each with at least
+ * OCGEO_CACHE_MIN_SHARD_BYTES, and large replies (e.g. with a `limit` of 100
+ * and annotations, a few hundred KB) fit in a part.
+ */
+#ifndef OCGEO_CACHE_SHARDS
+#define OCGEO_CACHE_SHARDS 16
+#endif
+#ifndef OCGEO_CACHE_MIN_SHARD_BYTES
+#define OCGEO_CACHE_MIN_SHARD_BYTES (1 << 20)
+#endif
+#define CACHE_MAX_SHARDS 1024
+#define CACHE_MIN_BUCKETS 64
+
+struct cache_entry {
+    struct cache_entry* chain; /* the next in the same bucket */
+    struct cache_entry* prev; /* the more recently used */
+    struct cache_entry* next; /* the less recently used */
+    uint64_t hash;
+    size_t size; /* counted against the limit */
+    int refs; /* the cache's and the readers', under the shard's lock */
+    sds key;
+    sds body;
+};
+
+struct cache_shard {
+    pthread_mutex_t lock;
+    struct cache_entry** buckets;
+    size_t bucket_count; /* a power of 2 */
+    struct cache_entry lru; /* the list head: `lru.next` is the most recently used */
+    size_t max_bytes;
+    ocgeo_cache_stats_t stats;
+    /* The shards are in an array, so keep them in different cache lines: */
+    char padding[64];
+};
+
+struct ocgeo_cache {
+    unsigned shard_count; /* a power of 2 */
+    struct cache_shard shards[];
+};
+
+static void
+cache_entry_free(struct cache_entry* e)
+{
+    sdsfree(e->key);
+    sdsfree(e->body);
+    free(e);
+}
+
+static void
+cache_unlink(struct cache_entry* e)
+{
+    e->prev->next = e->next;
+    e->next->prev = e->prev;
+}
+
+static void
+cache_push_front(struct cache_shard* shard, struct cache_entry* e)
+{
+    e->prev = &shard->lru;
+    e->next = shard->lru.next;
+    shard->lru.next->prev = e;
+    shard->lru.next = e;
+}
+
+/* The shard is selected by the high bits of the hash, the bucket by the low */
+static struct cache_shard*
+cache_shard(ocgeo_cache_t* cache, uint64_t hash)
+{
+    return &cache->shards[(hash >> 32) & (cache->shard_count - 1)];
+}
+
+static struct cache_entry**
+cache_find(struct cache_shard* shard, const char* key, size_t len, uint64_t hash)
+{
+    struct cache_entry** p = &shard->buckets[hash & (shard->bucket_count - 1)];
+    while (*p != NULL && !((*p)->hash == hash && sdslen((*p)->key) == len &&
+                           memcmp((*p)->key, key, len) == 0))
+        p = &(*p)->chain;
+    return p;
+}
+
+/* Remove the entry, given the link to it in its bucket */
+static void
+cache_remove(struct cache_shard* shard, struct cache_entry** link)
+{
+    struct cache_entry* e = *link;
+    *link = e->chain;
+    cache_unlink(e);
+    shard->stats.entries--;
+    shard->stats.bytes -= e->size;
+}
+
+/* Double the buckets, keeping the load factor at most 1 */
+static void
+cache_grow(struct cache_shard* shard)
+{
+    size_t count = shard->bucket_count * 2;
+    struct cache_entry** buckets = calloc(count, sizeof(struct cache_entry*));
+    if (buckets == NULL)
+        return; /* the chains just get longer */
+    for (size_t i = 0; i < shard->bucket_count; ++i) {
+        struct cache_entry* e = shard->buckets[i];
+        while (e != NULL) {
+            struct cache_entry* chain = e->chain;
+            e->chain = buckets[e->hash & (count - 1)];
+            buckets[e->hash & (count - 1)] = e;
+            e = chain;
+        }
+    }
+    free(shard->buckets);
+    shard->buckets = buckets;
+    shard->bucket_count = count;
+}
+
+ocgeo_cache_t* ocgeo_cache_new(size_t max_bytes, int shards)
+{
+    unsigned count = 1;
+    if (shards <= 0) {
+        shards = OCGEO_CACHE_SHARDS;
+        while (shards > 1 && max_bytes / shards < OCGEO_CACHE_MIN_SHARD_BYTES)
+            shards /= 2;
+    }
+    while (count < (unsigned) shards && count < CACHE_MAX_SHARDS)
+        count *= 2;
+    ocgeo_cache_t* cache = calloc(1, sizeof(ocgeo_cache_t) + count * sizeof(struct cache_shard));
+    if (cache == NULL)
+        return NULL;
+    for (unsigned i = 0; i < count; ++i) {
+        struct cache_shard* shard = &cache->shards[i];
+        shard->buckets = calloc(CACHE_MIN_BUCKETS, sizeof(struct cache_entry*));
+        if (shard->buckets == NULL) {
+            ocgeo_cache_free(cache);
+            return NULL;
+        }
+        cache->shard_count = i + 1;
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->bucket_count = CACHE_MIN_BUCKETS;
+        shard->lru.prev = shard->lru.next = &shard->lru;
+        shard->max_bytes = max_bytes / count;
+    }
+    return cache;
+}
+
+void ocgeo_cache_free(ocgeo_cache_t* cache)
+{
+    if (cache == NULL)
+        return;
+    for (unsigned i = 0; i < cache->shard_count; ++i) {
+        struct cache_shard* shard = &cache->shards[i];
+        struct cache_entry* e = shard->lru.next;
+        while (e != &shard->lru) {
+            struct cache_entry* next = e->next;
+            cache_entry_free(e);
+            e = next;
+        }
+        free(shard->buckets);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    free(cache);
+}
+
+void ocgeo_cache_get_stats(ocgeo_cache_t* cache, ocgeo_cache_stats_t* stats)
+{
+    memset(stats, 0, sizeof(ocgeo_cache_stats_t));
+    for (unsigned i = 0; i < cache->shard_count; ++i) {
+        struct cache_shard* shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        stats->hits += shard->stats.hits;
+        stats->misses += shard->stats.misses;
+        stats->evictions += shard->stats.evictions;
+        stats->entries += shard->stats.entries;
+        stats->bytes += shard->stats.bytes;
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+/* Drop a reference to the entry, with the shard's lock held. Returns true if
+   it was the last one, and then the entry should be freed (without the lock) */
+static bool
+cache_entry_release(struct cache_entry* e)
+{
+    return --e->refs == 0;
+}
+
+/* Look up the reply for the `url`, copying its body into `*body` on a hit.
+   The copy is made without holding the lock: the entry is referenced
+   meanwhile, so it's not freed even if it's evicted. */
+static bool
+cache_get(ocgeo_cache_t* cache, sds url, sds* body)
+{
+    uint64_t hash = hash_string(url, sdslen(url));
+    struct cache_shard* shard = cache_shard(cache, hash);
+    pthread_mutex_lock(&shard->lock);
+    struct cache_entry* e = *cache_find(shard, url, sdslen(url), hash);
+    if (e != NULL) {
+        shard->stats.hits++;
+        cache_unlink(e);
+        cache_push_front(shard, e);
+        e->refs++;
+    }
+    else {
+        shard->stats.misses++;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    if (e == NULL)
+        return false;
+
+    *body = sdscpylen(*body, e->body, sdslen(e->body));
+    pthread_mutex_lock(&shard->lock);
+    bool last = cache_entry_release(e);
+    pthread_mutex_unlock(&shard->lock);
+    if (last)
+        cache_entry_free(e);
+    return true;
+}
+
+/* Add (or replace) the reply for the `url`, evicting the least recently used
+   ones of its shard if needed. The copies are made, and the evicted entries
+   are freed, without holding the lock. */
+static void
+cache_put(ocgeo_cache_t* cache, sds url, const char* body, size_t length)
+{
+    uint64_t hash = hash_string(url, sdslen(url));
+    struct cache_shard* shard = cache_shard(cache, hash);
+    size_t size = sizeof(struct cache_entry) + sdslen(url) + length;
+    if (size > shard->max_bytes)
+        return;
+    struct cache_entry* e = malloc(sizeof(struct cache_entry));
+    if (e == NULL)
+        return;
+    e->hash = hash;
+    e->size = size;
+    e->refs = 1;
+    e->key = sdsnewlen(url, sdslen(url));
+    e->body = sdsnewlen(body, length);
+    if (e->key == NULL || e->body == NULL) {
+        cache_entry_free(e);
+        return;
+    }
+
+    /* The removed entries that no reader is copying, to be freed: */
+    struct cache_entry* evicted = NULL;
+    pthread_mutex_lock(&shard->lock);
+    struct cache_entry** link = cache_find(shard, e->key, sdslen(e->key), hash);
+    if (*link != NULL) {
+        struct cache_entry* old = *link;
+        cache_remove(shard, link);
+        if (cache_entry_release(old)) {
+            old->chain = NULL;
+            evicted = old;
+        }
+    }
+    while (shard->stats.bytes + size > shard->max_bytes) {
+        struct cache_entry* lru = shard->lru.prev;
+        cache_remove(shard, cache_find(shard, lru->key, sdslen(lru->key), lru->hash));
+        shard->stats.evictions++;
+        if (cache_entry_release(lru)) {
+            lru->chain = evicted;
+            evicted = lru;
+        }
+    }
+    if (shard->stats.entries >= shard->bucket_count)
+        cache_grow(shard);
+    struct cache_entry** bucket = &shard->buckets[hash & (shard->bucket_count - 1)];
+    e->chain = *bucket;
+    *bucket = e;
+    cache_push_front(shard, e);
+    shard->stats.entries++;
+    shard->stats.bytes += size;
+    pthread_mutex_unlock(&shard->lock);
+
+    while (evicted != NULL) {
+        struct cache_entry* chain = evicted->chain;
+        cache_entry_free(evicted);
+        evicted = chain;
+    }
+}
+
+/*
+ * The persistent cache of the replies, in two files that are mapped (read
+ * only) into memory: an index, i.e. a hash table with open addressing (and
+ * linear probing) from the hash of the key to the offset of its record, and
+ * an append only log of the records, each with the key and the body. The
+ * files have a fixed size, set when they are created, and are sparse until
+ * filled in. A process that opens them serves hits at once, there's nothing
+ * to load.
+ * The records and the index are updated with pwrite, which the mappings see
+ * at once, and the lookups take no locks: a record is used only if its
+ * checksum and its key match, so a record that is being written (or was torn
+ * by a crash) is a miss. The writers, in this and in other processes, are
+ * serialized with a mutex and a lock on the log file. The files are in the
+ * byte order of the machine.
+ */
+#define DISK_INDEX_MAGIC 0x31584449474f434fULL /* "OCOGIDX1" */
+#define DISK_LOG_MAGIC 0x31474f4c474f434fULL /* "OCOGLOG1" */
+#define DISK_MIN_BYTES (64*1024)
+#define DISK_MIN_SLOTS 1024
+/* The average size of a record, for sizing the index: */
+#define DISK_RECORD_ESTIMATE 1024
+#define DISK_ALIGN(n) (((n) + 7) & ~(size_t) 7)
+/* The generation of a log that was replaced by a compaction: */
+#define DISK_RETIRED UINT64_MAX
+
+struct disk_header {
+    uint64_t magic;
+    uint64_t capacity; /* the slots of the index, or the bytes of the log */
+    uint64_t used; /* the slots in use, or the end of the log */
+    uint64_t generation; /* the number of compactions, the same in both files */
+};
+
+struct disk_slot {
+    uint64_t hash;
+    uint64_t offset; /* of the record in the log, 0 if the slot is empty */
+};
+
+struct disk_record {
+    uint64_t checksum; /* of the rest of the record */
+    uint32_t key_length;
+    uint32_t body_length;
+    /* followed by the key and the body, padded to 8 bytes */
+};
+
+struct ocgeo_disk_cache {
+    int index_fd;
+    int log_fd;
+    const struct disk_header* index; /* followed by the slots */
+    const struct disk_header* log;
+    size_t index_size;
+    size_t log_size;
+    pthread_mutex_t lock; /* for writing, and for the counters */
+    unsigned long hits;
+    unsigned long misses;
+};
+
+static const struct disk_slot*
+disk_slots(ocgeo_disk_cache_t* dc)
+{
+    return (const struct disk_slot*) (dc->index + 1);
+}
+
+static uint64_t
+disk_checksum(const struct disk_record* record)
+{
+    return hash_string((const char*) &record->key_length,
+                       2 * sizeof(uint32_t) + record->key_length + record->body_length);
+}
+
+/* The valid record at `offset` of the log, or NULL */
+static const struct disk_record*
+disk_record_at(ocgeo_disk_cache_t* dc, uint64_t offset)
+{
+    if (offset < sizeof(struct disk_header) || offset % 8 != 0 ||
+        offset + sizeof(struct disk_record) > dc->log_size)
+        return NULL;
+    const struct disk_record* record = (const struct disk_record*) ((const char*) dc->log + offset);
+    if ((uint64_t) record->key_length + record->body_length > dc->log_size - offset - sizeof(struct disk_record))
+        return NULL;
+    return disk_checksum(record) == record->checksum ? record : NULL;
+}
+
+/* Find the slot of the key, or the one where it would be added: a slot with
+   the same hash but a torn record (most likely of the same key), or else the
+   first empty one. Returns NULL if the index is full. */
+static const struct disk_slot*
+disk_find(ocgeo_disk_cache_t* dc, const char* key, size_t len, uint64_t hash,
+          const struct disk_record** found)
+{
+    const struct disk_slot* slots = disk_slots(dc);
+    const struct disk_slot* torn = NULL;
+    uint64_t mask = dc->index->capacity - 1;
+    *found = NULL;
+    for (uint64_t i = hash & mask, n = 0; n <= mask; i = (i + 1) & mask, ++n) {
+        if (slots[i].offset == 0)
+            return torn != NULL ? torn : &slots[i];
+        if (slots[i].hash != hash)
+            continue;
+        const struct disk_record* record = disk_record_at(dc, slots[i].offset);
+        if (record == NULL && torn == NULL)
+            torn = &slots[i];
+        if (record != NULL && record->key_length == len &&
+            memcmp((const char*) (record + 1), key, len) == 0) {
+            *found = record;
+            return &slots[i];
+        }
+    }
+    return torn;
+}
+
+/* Map a file of `size` bytes, creating it with the header if it's empty (and
+   `create` is set). Returns its size, or 0 on error. */
+static size_t
+disk_map_file(int fd, uint64_t magic, uint64_t capacity, uint64_t used, size_t size,
+              bool create, const struct disk_header** map)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        return 0;
+    if (st.st_size == 0 && !create)
+        return 0;
+    if (st.st_size == 0) {
+        struct disk_header header = {magic, capacity, used, 0};
+        if (ftruncate(fd, (off_t) size) != 0 ||
+            pwrite(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header))
+            return 0;
+    }
+    else {
+        size = (size_t) st.st_size;
+    }
+    if (size < sizeof(struct disk_header))
+        return 0;
+    void* p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+        return 0;
+    *map = p;
+    if ((*map)->magic != magic) {
+        munmap(p, size);
+        return 0;
+    }
+    return size;
+}
+
+/* Map the index file, checking that it matches the (mapped) log */
+static bool
+disk_map_index(ocgeo_disk_cache_t* dc, uint64_t slots, bool create)
+{
+    dc->index_size = disk_map_file(dc->index_fd, DISK_INDEX_MAGIC, slots, 0,
+        sizeof(struct disk_header) + slots * sizeof(struct disk_slot), create, &dc->index);
+    return dc->index_size != 0 &&
+        dc->index_size == sizeof(struct disk_header) + dc->index->capacity * sizeof(struct disk_slot) &&
+        (dc->index->capacity & (dc->index->capacity - 1)) == 0;
+}
+
+static void
+disk_unmap_index(ocgeo_disk_cache_t* dc)
+{
+    if (dc->index_size > 0)
+        munmap((void*) dc->index, dc->index_size);
+    if (dc->index_fd >= 0)
+        close(dc->index_fd);
+    dc->index_size = 0;
+    dc->index_fd = -1;
+}
+
+/* Complete a compaction that was interrupted after replacing the log, i.e.
+   replace the index with the new one, which has the same generation as the
+   log. Called with the log locked. */
+static bool
+disk_finish_compaction(ocgeo_disk_cache_t* dc, const char* index_path)
+{
+    sds new_index_path = sdscatprintf(sdsempty(), "%s.tmp", index_path);
+    disk_unmap_index(dc);
+    dc->index_fd = open(new_index_path, O_RDWR);
+    bool ok = dc->index_fd >= 0 && disk_map_index(dc, 0, false) &&
+        dc->index->generation == dc->log->generation &&
+        fsync(dc->index_fd) == 0 && rename(new_index_path, index_path) == 0;
+    sdsfree(new_index_path);
+    return ok;
+}
+
+/* Open the files of the cache and map them. They're created, with room for
+   `max_bytes` of replies, if they don't exist and `create` is set. */
+static ocgeo_disk_cache_t*
+disk_cache_open(const char* index_path, const char* log_path, size_t max_bytes, bool create)
+{
+    if (max_bytes < DISK_MIN_BYTES)
+        max_bytes = DISK_MIN_BYTES;
+    /* At most half of the slots are used, see `disk_cache_put`: */
+    uint64_t slots = DISK_MIN_SLOTS;
+    while (slots < max_bytes / DISK_RECORD_ESTIMATE * 2)
+        slots *= 2;
+    int flags = O_RDWR | (create ? O_CREAT : 0);
+
+    for (;;) {
+        ocgeo_disk_cache_t* dc = calloc(1, sizeof(ocgeo_disk_cache_t));
+        if (dc == NULL)
+            return NULL;
+        pthread_mutex_init(&dc->lock, NULL);
+        dc->index_fd = -1;
+        dc->log_fd = open(log_path, flags, 0644);
+        if (dc->log_fd < 0) {
+            ocgeo_disk_cache_close(dc);
+            return NULL;
+        }
+        /* Another process may be creating or compacting them. The index is
+           opened with the log locked, so that both are of the same compaction: */
+        flock(dc->log_fd, LOCK_EX);
+        dc->log_size = disk_map_file(dc->log_fd, DISK_LOG_MAGIC, max_bytes, sizeof(struct disk_header),
+            max_bytes, create, &dc->log);
+        bool ok = dc->log_size != 0 && dc->log_size == dc->log->capacity;
+        bool retired = ok && dc->log->generation == DISK_RETIRED;
+        if (ok && !retired) {
+            dc->index_fd = open(index_path, flags, 0644);
+            ok = dc->index_fd >= 0 && disk_map_index(dc, slots, create);
+            if (ok && dc->index->generation != dc->log->generation)
+                ok = disk_finish_compaction(dc, index_path);
+        }
+        flock(dc->log_fd, LOCK_UN);
+        if (ok && !retired)
+            return dc;
+        ocgeo_disk_cache_close(dc);
+        /* The log was replaced by a compaction after it was opened, try again: */
+        if (!retired)
+            return NULL;
+    }
+}
+
+ocgeo_disk_cache_t* ocgeo_disk_cache_open(const char* path, size_t max_bytes)
+{
+    sds index_path = sdscatprintf(sdsempty(), "%s.idx", path);
+    sds log_path = sdscatprintf(sdsempty(), "%s.log", path);
+    ocgeo_disk_cache_t* dc = disk_cache_open(index_path, log_path, max_bytes, max_bytes > 0);
+    sdsfree(index_path);
+    sdsfree(log_path);
+    return dc;
+}
+
+void ocgeo_disk_cache_close(ocgeo_disk_cache_t* dc)
+{
+    if (dc == NULL)
+        return;
+    disk_unmap_index(dc);
+    if (dc->log_size > 0)
+        munmap((void*) dc->log, dc->log_size);
+    if (dc->log_fd >= 0)
+        close(dc->log_fd);
+    pthread_mutex_destroy(&dc->lock);
+    free(dc);
+}
+
+void ocgeo_disk_cache_get_stats(ocgeo_disk_cache_t* dc, ocgeo_cache_stats_t* stats)
+{
+    memset(stats, 0, sizeof(ocgeo_cache_stats_t));
+    pthread_mutex_lock(&dc->lock);
+    stats->hits = dc->hits;
+    stats->misses = dc->misses;
+    pthread_mutex_unlock(&dc->lock);
+    stats->entries = dc->index->used;
+    stats->bytes = dc->log->used;
+}
+
+/* Look up the reply for the `url`, copying its body into `*body` on a hit */
+static bool
+disk_cache_get(ocgeo_disk_cache_t* dc, sds url, sds* body)
+{
+    const struct disk_record* record;
+    disk_find(dc, url, sdslen(url), hash_string(url, sdslen(url)), &record);
+    if (record != NULL)
+        *body = sdscpylen(*body, (const char*) (record + 1) + record->key_length, record->body_length);
+    pthread_mutex_lock(&dc->lock);
+    if (record != NULL)
+        dc->hits++;
+    else
+        dc->misses++;
+    pthread_mutex_unlock(&dc->lock);
+    return record != NULL;
+}
+
+/* Append the record of the reply for the `url` to the log and point its slot
+   to it. When the log or the index is full, or the files were replaced by a
+   compaction, the reply is not added and false is returned, see
+   `ocgeo_disk_cache_compact`. */
+static bool
+disk_cache_put(ocgeo_disk_cache_t* dc, sds url, const char* body, size_t length)
+{
+    size_t size = DISK_ALIGN(sizeof(struct disk_record) + sdslen(url) + length);
+    if (size > dc->log_size || sdslen(url) > UINT32_MAX || length > UINT32_MAX)
+        return false;
+    struct disk_record* record = calloc(1, size);
+    if (record == NULL)
+        return false;
+    record->key_length = (uint32_t) sdslen(url);
+    record->body_length = (uint32_t) length;
+    memcpy(record + 1, url, sdslen(url));
+    memcpy((char*) (record + 1) + sdslen(url), body, length);
+    record->checksum = disk_checksum(record);
+    uint64_t hash = hash_string(url, sdslen(url));
+
+    pthread_mutex_lock(&dc->lock);
+    flock(dc->log_fd, LOCK_EX);
+    bool ok = false;
+    uint64_t end = dc->log->used;
+    uint64_t used = dc->index->used;
+    const struct disk_record* found;
+    const struct disk_slot* slot = disk_find(dc, url, sdslen(url), hash, &found);
+    bool new_slot = slot != NULL && slot->offset == 0;
+    /* A retired log has a different generation than its index: */
+    if (slot != NULL && dc->log->generation == dc->index->generation &&
+        end + size <= dc->log_size && (!new_slot || used < dc->index->capacity / 2)) {
+        /* The record first, so that the index never points to a missing one: */
+        struct disk_slot update = {hash, end};
+        off_t slot_offset = (const char*) slot - (const char*) dc->index;
+        uint64_t new_end = end + size;
+        uint64_t new_used = used + 1;
+        ok = pwrite(dc->log_fd, record, size, (off_t) end) == (ssize_t) size &&
+            pwrite(dc->log_fd, &new_end, sizeof(uint64_t), offsetof(struct disk_header, used)) ==
+                (ssize_t) sizeof(uint64_t) &&
+            pwrite(dc->index_fd, &update, sizeof(update), slot_offset) == (ssize_t) sizeof(update) &&
+            (!new_slot || pwrite(dc->index_fd, &new_used, sizeof(uint64_t),
+                offsetof(struct disk_header, used)) == (ssize_t) sizeof(uint64_t));
+    }
+    flock(dc->log_fd, LOCK_UN);
+    pthread_mutex_unlock(&dc->lock);
+    free(record);
+    return ok;
+}
+
+/* Set the generation in the header of a file */
+static bool
+disk_set_generation(int fd, uint64_t generation)
+{
+    return pwrite(fd, &generation, sizeof(uint64_t), offsetof(struct disk_header, generation)) ==
+        (ssize_t) sizeof(uint64_t);
+}
+
+bool ocgeo_disk_cache_compact(const char* path, size_t max_bytes)
+{
+    sds index_path = sdscatprintf(sdsempty(), "%s.idx", path);
+    sds log_path = sdscatprintf(sdsempty(), "%s.log", path);
+    sds new_index_path = sdscatprintf(sdsempty(), "%s.idx.tmp", path);
+    sds new_log_path = sdscatprintf(sdsempty(), "%s.log.tmp", path);
+    ocgeo_disk_cache_t* dc = disk_cache_open(index_path, log_path, 0, false);
+    ocgeo_disk_cache_t* compacted = NULL;
+    bool ok = dc != NULL, replaced = false;
+    if (ok) {
+        if (max_bytes == 0)
+            max_bytes = dc->log_size;
+        unlink(new_index_path);
+        unlink(new_log_path);
+        /* No process should write while the records are copied: */
+        flock(dc->log_fd, LOCK_EX);
+        /* unless another compaction replaced the files meanwhile */
+        if (dc->log->generation != DISK_RETIRED)
+            compacted = disk_cache_open(new_index_path, new_log_path, max_bytes, true);
+        ok = compacted != NULL;
+    }
+    const struct disk_slot* slots = ok ? disk_slots(dc) : NULL;
+    for (uint64_t i = 0; ok && i < dc->index->capacity; ++i) {
+        const struct disk_record* record = disk_record_at(dc, slots[i].offset);
+        if (slots[i].offset == 0 || record == NULL)
+            continue;
+        sds key = sdsnewlen(record + 1, record->key_length);
+        ok = disk_cache_put(compacted, key, (const char*) (record + 1) + record->key_length,
+            record->body_length);
+        sdsfree(key);
+    }
+    if (ok) {
+        /* The log is replaced first and then the index, which has the same
+           generation: if this is interrupted in between, the next open
+           completes it, see `disk_cache_open`. Both new files are locked,
+           so that no process opens them before. */
+        uint64_t generation = dc->log->generation + 1;
+        flock(compacted->log_fd, LOCK_EX);
+        ok = disk_set_generation(compacted->log_fd, generation) &&
+            disk_set_generation(compacted->index_fd, generation) &&
+            fsync(compacted->log_fd) == 0 && fsync(compacted->index_fd) == 0 &&
+            rename(new_log_path, log_path) == 0;
+        replaced = ok;
+        ok = ok && rename(new_index_path, index_path) == 0;
+        /* The processes that have the old files open stop adding to them: */
+        if (replaced)
+            disk_set_generation(dc->log_fd, DISK_RETIRED);
+        flock(compacted->log_fd, LOCK_UN);
+    }
+    if (dc != NULL)
+        flock(dc->log_fd, LOCK_UN);
+    if (!replaced && compacted != NULL) {
+        unlink(new_index_path);
+        unlink(new_log_path);
+    }
+
+    ocgeo_disk_cache_close(compacted);
+    ocgeo_disk_cache_close(dc);
+    sdsfree(index_path);
+    sdsfree(log_path);
+    sdsfree(new_index_path);
+    sdsfree(new_log_path);
+    return ok;
+}
+
+/* Look up the reply for the `url` in the caches of the `params`, first in
+   memory and then on disk. A hit on disk is added to the memory cache. */
+static bool
+cached_reply(ocgeo_params_t* params, sds url, sds* body)
+{
+    if (params->cache != NULL && cache_get(params->cache, url, body))
+        return true;
+    if (params->disk_cache != NULL && disk_cache_get(params->disk_cache, url, body)) {
+        if (params->cache != NULL)
+            cache_put(params->cache, url, *body, sdslen(*body));
+        return true;
+    }
+    return false;
+}
+
+/* Add the reply for the `url` to the caches of the `params` */
+static void
+cache_reply(ocgeo_params_t* params, sds url, const char* body, size_t length)
+{
+    if (params->cache != NULL)
+        cache_put(params->cache, url, body, length);
+    if (params->disk_cache != NULL)
+        disk_cache_put(params->disk_cache, url, body, length);
+}
+
+/*
+ * A process wide "share" object, so that all the handles created by the
+ * library (in any thread) share the DNS cache and the TLS sessions. It is
+ * created on first use. The connections are not shared: libcurl does not
+ * support a connection pool used by many threads at once, so each client
+ * (and batch) keeps its own.
+ */
+#if !defined(OCGEO_NO_CURL_SHARE)
+static CURLSH* curl_share = NULL;
+static pthread_mutex_t curl_share_locks[CURL_LOCK_DATA_LAST];
+static pthread_once_t curl_share_once = PTHREAD_ONCE_INIT;
+
+static void
+share_lock(CURL* handle, curl_lock_data data, curl_lock_access access, void* userptr)
+{
+    (void) handle; (void) access; (void) userptr;
+    pthread_mutex_lock(&curl_share_locks[data]);
+}
+
+static void
+share_unlock(CURL* handle, curl_lock_data data, void* userptr)
+{
+    (void) handle; (void) userptr;
+    pthread_mutex_unlock(&curl_share_locks[data]);
+}
+
+static void
+share_init(void)
+{
+    /* `curl_global_init` is not thread safe (in older libcurls), so it's better
+       to do it explicitly here, once: */
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; ++i)
+        pthread_mutex_init(&curl_share_locks[i], NULL);
+    CURLSH* share = curl_share_init();
+    if (share == NULL)
+        return;
+    curl_share_setopt(share, CURLSHOPT_LOCKFUNC, share_lock);
+    curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share = share;
+}
+
+static CURLSH*
+get_curl_share(void)
+{
+    pthread_once(&curl_share_once, share_init);
+    return curl_share;
+}
+
+static void
+share_cleanup(void)
+{
+    if (curl_share != NULL) {
+        curl_share_cleanup(curl_share);
+        curl_share = NULL;
+    }
+}
+#else
+static CURLSH*
+get_curl_share(void)
+{
+    return NULL;
+}
+
+static void
+share_cleanup(void)
+{
+}
+#endif
+
+void ocgeo_global_cleanup(void)
+{
+    share_cleanup();
+    intern_cleanup();
+}
+
+static sds
+make_user_agent(void)
+{
+    sds user_agent = sdsempty();
+    return sdscatprintf(user_agent, "c-ocgeo/%s (%s)", ocgeo_version, curl_version());
+}
+
+/* Create a new "easy" handle, with all the options that do not depend on the
+   specific request. */
+static CURL*
+new_curl_handle(const char* user_agent)
+{
+    CURLSH* share = get_curl_share();
+    CURL *curl = curl_easy_init();
+    if (curl == NULL)
+        return NULL;
+    if (share != NULL)
+        curl_easy_setopt(curl, CURLOPT_SHARE, share);
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, user_agent);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    /* Signals are not thread safe, and required for timeouts only with the
+       synchronous DNS resolver: */
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    return curl;
+}
+
+/* Set the options of the handle that depend on the request's params. Since
+   handles are reused, all of them should be set (or reset) every time. */
+static void
+set_request_options(CURL* curl, ocgeo_params_t* params, long timeout_ms)
+{
+    if (params->timeout_ms > 0 && (timeout_ms <= 0 || params->timeout_ms < timeout_ms))
+        timeout_ms = params->timeout_ms;
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout_ms > 0 ? timeout_ms : 0L);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, params->connect_timeout_ms > 0 ? (long) params->connect_timeout_ms : 0L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, params->low_speed_limit > 0 ? (long) params->low_speed_limit : 0L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, params->low_speed_time > 0 ? (long) params->low_speed_time : 0L);
+    /* An empty string means all the encodings supported by libcurl: */
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, params->no_compression ? NULL : "");
+}
+
+static void
+set_transfer_error(ocgeo_response_t* response, CURLcode res)
+{
+    set_error(response, OCGEO_ERROR_TRANSPORT, res, 0);
+    if (res == CURLE_OPERATION_TIMEDOUT)
+        set_local_status(response, OCGEO_CODE_DEADLINE_EXCEEDED);
+}
+
+/* Append the (percent) URL encoding of the string, as `curl_easy_escape` does */
+static sds
+url_escape_cat(sds url, const char* str)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    for (const unsigned char* p = (const unsigned char*) str; *p; ++p) {
+        unsigned char c = *p;
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+            c == '-' || c == '.' || c == '_' || c == '~') {
+            url = sdscatlen(url, (const char*) p, 1);
+        }
+        else {
+            char escaped[3] = {'%', hex[c >> 4], hex[c & 0xF]};
+            url = sdscatlen(url, escaped, 3);
+        }
+    }
+    return url;
+}
+
+/* Like `sdscatprintf` but without its temporary allocation, for short strings */
+static sds
+url_catprintf(sds url, const char* fmt, ...)
+{
+    char buf[128];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (len < 0)
+        return url;
+    if ((size_t) len < sizeof(buf))
+        return sdscatlen(url, buf, len);
+    va_start(ap, fmt);
+    url = sdscatvprintf(url, fmt, ap);
+    va_end(ap);
+    return url;
+}
+
+/* The fields of the results to parse, see OCGEO_FIELD_* */
+static unsigned
+requested_fields(ocgeo_params_t* params)
+{
+    return params->fields ? params->fields : OCGEO_FIELDS_ALL;
+}
+
+static sds
+build_url(sds url, bool is_fwd, const char* q, const char* api_key,
+          ocgeo_params_t* params)
+{
+    url = sdscat(url, params->api_server ? params->api_server : OCG_API_SERVER);
+    url = sdscat(url, "?q=");
+    url = url_escape_cat(url, q);
+    url = sdscat(url, "&key=");
+    url = sdscat(url, api_key);
+    if (params->abbrv)
+        url = sdscat(url, "&abbrv=1");
+    if (is_fwd && params->countrycode)
+        url = url_catprintf(url, "&countrycode=%s", params->countrycode);
+    if (params->language)
+        url = url_catprintf(url, "&language=%s", params->language);
+    if (params->limit)
+        url = url_catprintf(url, "&limit=%d", params->limit);
+    if (params->min_confidence)
+        url = url_catprintf(url, "&min_confidence=%d", params->min_confidence);
+    bool no_annotations = params->no_annotations ||
+        (requested_fields(params) & OCGEO_FIELDS_ANNOTATIONS) == 0;
+    url = sdscat(url, no_annotations ? "&no_annotations=1" : "&no_annotations=0");
+    if (params->no_dedupe)
+        url = sdscat(url, "&no_dedupe=1");
+    if (params->no_record)
+        url = sdscat(url, "&no_record=1");
+    if (is_fwd && params->roadinfo)
+        url = sdscat(url, "&roadinfo=1");
+    if (is_fwd && ocgeo_is_valid_latlng(params->proximity))
+        url = url_catprintf(url, "&proximity=%.8F,%.8F", params->proximity.lat, params->proximity.lng);
+
+    /* The value of the bounds parameter should be specified as two coordinate
+       points forming the south-west and north-east corners of a bounding box.
+       For example: bounds=-0.563160,51.280430,0.278970,51.683979 (min lon, min
+       lat, max lon, max lat). */
+    if (ocgeo_is_valid_bounds(&params->bounds))
+        url = url_catprintf(url, "&bounds=%.8F,%.8F,%.8F,%.8F", 
+            params->bounds.southwest.lng, params->bounds.southwest.lat, 
+            params->bounds.northeast.lng, params->bounds.northeast.lat);
+    return url;
+}
+
+static void
+get_transfer_info(CURL* curl, ocgeo_transfer_info_t* info)
+{
+    long version = 0, code = 0;
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &info->total_time);
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &info->connects);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+    info->http_status = (int) code;
+#if LIBCURL_VERSION_NUM >= 0x073700 /* 7.55.0 */
+    curl_off_t bytes = 0;
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+#else
+    double bytes = 0;
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD, &bytes);
+#endif
+    info->bytes = (long) bytes;
+#if LIBCURL_VERSION_NUM >= 0x073200 /* 7.50.0 */
+    curl_easy_getinfo(curl, CURLINFO_HTTP_VERSION, &version);
+#endif
+    switch (version) {
+    case CURL_HTTP_VERSION_1_0: info->http_version = 10; break;
+    case CURL_HTTP_VERSION_1_1: info->http_version = 11; break;
+    case CURL_HTTP_VERSION_2_0: info->http_version = 20; break;
+#if LIBCURL_VERSION_NUM >= 0x074200 /* 7.66.0 */
+    case CURL_HTTP_VERSION_3: info->http_version = 30; break;
+#endif
+    default: info->http_version = 0;
+    }
+}
+
+/* Whether the body of the next reply should be passed to the `body_callback`.
+   The replies are sampled at random, with the random state of the client (or
+   batch) that makes the request, so there's no state shared between threads. */
+static bool
+sample_body(ocgeo_params_t* params, uint64_t* rng)
+{
+    if (params->body_callback == NULL)
+        return false;
+    if (params->body_sample_rate <= 1)
+        return true;
+    return random_uniform(rng) * params->body_sample_rate < 1.0;
+}
+
+/* Parse the (complete) body of a reply into the response, applying the
+   options of the `params`. The body is not freed (it can be a reused buffer)
+   and the `url` is owned by the response afterwards. */
+static bool
+parse_body(struct http_response* r, sds url, ocgeo_params_t* params, ocgeo_response_t* response)
+{
+    cJSON* json = r->stream ? stream_finish(r->stream, r->data) :
+        parse_reply(r->data, sdslen(r->data), response, requested_fields(params));
+    response->url = url;
+    if (json == NULL) {
+        /* Not a reply of the API, e.g. an error page of a proxy: */
+        if (response->transfer.http_status >= 400 && response->error.stage != OCGEO_ERROR_MEMORY)
+            set_error(response, OCGEO_ERROR_HTTP, response->transfer.http_status, 0);
+        return false;
+    }
+
+    if (params->dbg_callback != NULL) {
+        char* str = cJSON_Print(json);
+        params->dbg_callback(str, params->callback_data);
+        cJSON_free(str);
+    }
+    if (params->intern_strings)
+        intern_results(response);
+    if (params->compact)
+        ocgeo_response_compact(response);
+    return true;
+}
+
+/* Handle the body of a reply that was received, see `parse_body`. If
+   `sampled` the body is passed to the `body_callback`. */
+static bool
+handle_response_body(struct http_response* r, sds url, ocgeo_params_t* params,
+                     bool sampled, ocgeo_response_t* response)
+{
+    /* The raw body, before parsing it, so that invalid replies are included: */
+    if (sampled)
+        params->body_callback(r->data, sdslen(r->data), params->callback_data);
+
+    if (!parse_body(r, url, params, response))
+        return false;
+    if (r->stream == NULL && response->status.code == OCGEO_CODE_OK)
+        cache_reply(params, url, r->data, sdslen(r->data));
+    rate_limiter_feedback(params, response);
+    return true;
+}
+
+/* Handle the body of a reply that was found in the cache. Its rate info is
+   stale, so it's not used. */
+static bool
+handle_cached_body(struct http_response* r, sds url, ocgeo_params_t* params, ocgeo_response_t* response)
+{
+    bool ok = parse_body(r, url, params, response);
+    memset(&response->rateInfo, 0, sizeof(ocgeo_rate_info_t));
+    response->transfer.from_cache = true;
+    return ok;
+}
+
+/*
+ * Hedged requests: if a request has not completed after some delay (a
+ * percentile of the latencies observed by the client), a duplicate request is
+ * sent and the response that arrives first is used.
+ */
+#ifndef OCGEO_HEDGING_SAMPLES
+#define OCGEO_HEDGING_SAMPLES 128
+#endif
+/* Don't hedge before having enough latency samples: */
+#define OCGEO_HEDGING_MIN_SAMPLES 16
+
+struct hedging {
+    double percentile; /* e.g. 95 */
+    double max_extra_ratio; /* max ratio of hedged requests */
+    long requests;
+    long hedged;
+    double latencies[OCGEO_HEDGING_SAMPLES]; /* a ring buffer */
+    int count;
+    int next;
+};
+
+static int
+cmp_double(const void* a, const void* b)
+{
+    double x = *(const double*) a, y = *(const double*) b;
+    return x < y ? -1 : x > y;
+}
+
+static void
+hedging_record_latency(struct hedging* h, double latency)
+{
+    h->latencies[h->next] = latency;
+    h->next = (h->next + 1) % OCGEO_HEDGING_SAMPLES;
+    if (h->count < OCGEO_HEDGING_SAMPLES)
+        h->count++;
+}
+
+/* Returns the delay (secs) after which to hedge, or negative if we should not */
+static double
+hedging_delay(struct hedging* h)
+{
+    if (h->count < OCGEO_HEDGING_MIN_SAMPLES)
+        return -1;
+    if (h->hedged + 1 > h->max_extra_ratio * h->requests)
+        return -1;
+    double sorted[OCGEO_HEDGING_SAMPLES];
+    memcpy(sorted, h->latencies, h->count * sizeof(double));
+    qsort(sorted, h->count, sizeof(double), cmp_double);
+    int k = (int) (h->percentile / 100.0 * h->count);
+    return sorted[k < h->count ? k : h->count - 1];
+}
+
+struct ocgeo_client {
+    CURL* curl;
+    sds api_key;
+    sds user_agent;
+    ocgeo_params_t params;
+    /* The receive buffer, kept between requests: */
+    struct http_response body;
+
+    /* For hedging, see `hedged_perform`. NULL if not enabled */
+    struct hedging* hedging;
+    CURLM* multi;
+    CURL* hedge_curl;
+    struct http_response hedge_body;
+    uint64_t rng; /* for sampling the replies, see `sample_body` */
+};
+
+/* Perform the transfer (already set up in the client's "easy" handle), and
+   if it has not completed after the hedging delay, make a second identical
+   request with another handle. The first one that completes successfully
+   wins and the other is cancelled. Returns the result of the winner, whose
+   handle is returned in `winner`. */
+static CURLcode
+hedged_perform(ocgeo_client_t* client, ocgeo_params_t* params, long timeout_ms,
+               sds url, CURL** winner)
+{
+    struct hedging* h = client->hedging;
+    double start = monotonic_time();
+    double delay = hedging_delay(h);
+    h->requests++;
+    *winner = client->curl;
+    if (delay < 0) {
+        CURLcode res = curl_easy_perform(client->curl);
+        if (res == CURLE_OK)
+            hedging_record_latency(h, monotonic_time() - start);
+        return res;
+    }
+
+    client->hedge_body.data = recycle_buffer(client->hedge_body.data);
+    curl_easy_setopt(client->hedge_curl, CURLOPT_URL, url);
+    curl_easy_setopt(client->hedge_curl, CURLOPT_WRITEDATA, &client->hedge_body);
+    curl_easy_setopt(client->hedge_curl, CURLOPT_HEADERDATA, &client->hedge_body);
+    set_request_options(client->hedge_curl, params, timeout_ms);
+
+    CURLcode res = CURLE_OK;
+    CURL* done = NULL;
+    bool hedged = false;
+    bool can_hedge = true;
+    int active = 1;
+    curl_multi_add_handle(client->multi, client->curl);
+    while (done == NULL) {
+        int running;
+        if (curl_multi_perform(client->multi, &running) != CURLM_OK) {
+            res = CURLE_RECV_ERROR;
+            break;
+        }
+        CURLMsg* msg;
+        int msgs_left;
+        while (done == NULL && (msg = curl_multi_info_read(client->multi, &msgs_left)) != NULL) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+            active--;
+            res = msg->data.result;
+            /* A failed transfer loses, unless there's no other one: */
+            if (res == CURLE_OK || active == 0)
+                done = msg->easy_handle;
+        }
+        if (done != NULL)
+            break;
+
+        double elapsed = monotonic_time() - start;
+        if (!hedged && can_hedge && elapsed >= delay) {
+            double wait;
+            /* The hedged request should respect the rate limits too: */
+            if (params->rate_limiter == NULL ||
+                rate_limiter_take(params->rate_limiter, false, &wait) == RATE_LIMIT_ACQUIRED) {
+                log("Hedging after %.3f secs\n", elapsed);
+                curl_multi_add_handle(client->multi, client->hedge_curl);
+                hedged = true;
+                active++;
+                h->hedged++;
+                continue;
+            }
+            can_hedge = false;
+        }
+        int wait_ms = 1000;
+        if (!hedged && can_hedge)
+            wait_ms = (int) ((delay - elapsed) * 1000) + 1;
+        curl_multi_wait(client->multi, NULL, 0, wait_ms, NULL);
+    }
+    curl_multi_remove_handle(client->multi, client->curl);
+    if (hedged)
+        curl_multi_remove_handle(client->multi, client->hedge_curl);
+
+    if (done != NULL)
+        *winner = done;
+    if (res == CURLE_OK)
+        hedging_record_latency(h, monotonic_time() - start);
+    return res;
+}
+
+/* A single attempt of a request, see `do_request` */
+static bool
+do_request_attempt(ocgeo_client_t* client, bool is_fwd, const char* q,
+                   ocgeo_params_t* params, long timeout_ms, ocgeo_response_t* response)
+{
+    /* The response is empty, but it may have memory to reuse: */
+    ocgeo_response_reset(response);
+
+    sds url = build_url(response->url ? response->url : sdsempty(), is_fwd, q, client->api_key, params);
+    log("URL=%s\n", url);
+    response->url = url;
+
+    client->body.data = recycle_buffer(client->body.data);
+    if (cached_reply(params, url, &client->body.data))
+        return handle_cached_body(&client->body, url, params, response);
+
+    if (!ocgeo_rate_limiter_acquire(params->rate_limiter, !params->rate_limit_nowait)) {
+        set_local_status(response, OCGEO_CODE_RATE_LIMITED);
+        return false;
+    }
+
+    CURL* curl = client->curl;
+    /* The two transfers of a hedged request cannot both parse into the
+       response, and the body callback and the cache need the whole body: */
+    bool sampled = sample_body(params, &client->rng);
+    struct stream_parser stream;
+    if (params->streaming_parse && client->hedging == NULL && !sampled &&
+        params->cache == NULL && params->disk_cache == NULL && stream_init(&stream, response, requested_fields(params)))
+        client->body.stream = &stream;
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &client->body);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &client->body);
+    set_request_options(curl, params, timeout_ms);
+    CURLcode res;
+    if (client->hedging)
+        res = hedged_perform(client, params, timeout_ms, url, &curl);
+    else
+        res = curl_easy_perform(curl);
+    get_transfer_info(curl, &response->transfer);
+
+    bool ok = false;
+    if (res != CURLE_OK)
+        set_transfer_error(response, res);
+    else {
+        struct http_response* r = curl == client->curl ? &client->body : &client->hedge_body;
+        ok = handle_response_body(r, url, params, sampled, response);
+    }
+    client->body.stream = NULL;
+    return ok;
+}
+
+/* Perform the request using the client, retrying it according to the retry
+   policy in `params`. */
+static bool
+do_request(ocgeo_client_t* client, bool is_fwd, const char* q,
+           ocgeo_params_t* params, ocgeo_response_t* response)
+{
+    if (params == NULL) {
+        ocgeo_params_t params = ocgeo_default_params();
+        return do_request(client, is_fwd, q, &params, response);
+    }
+
+    /* Make sure that we have a proper response: */
+    if (response == NULL)
+        return false;
+    if (!params->reuse_response)
+        memset(response, 0, sizeof(ocgeo_response_t));
+
+    double start = monotonic_time();
+    uint64_t rng = random_seed(response);
+    bool ok = do_request_attempt(client, is_fwd, q, params,
+                                 params->retry.deadline_ms, response);
+    for (int attempts = 1; ; ++attempts) {
+        double elapsed = monotonic_time() - start;
+        double delay = retry_delay(&params->retry, attempts, elapsed, response, &rng);
+        if (delay < 0)
+            return ok;
+        log("Retrying (status=%d) in %.3f secs\n", response_status(response), delay);
+        ocgeo_response_reset(response);
+        sleep_for(delay);
+        /* The attempt should not exceed the overall deadline (0 would mean
+           no limit at all): */
+        long remaining_ms = 0;
+        if (params->retry.deadline_ms > 0) {
+            remaining_ms = params->retry.deadline_ms -
+                (long) ((monotonic_time() - start) * 1000);
+            if (remaining_ms <= 0)
+                remaining_ms = 1;
+        }
+        ok = do_request_attempt(client, is_fwd, q, params, remaining_ms, response);
+    }
+}
+
+/* A "one-shot" request, with a client that is not reused */
+static bool
+do_oneshot_request(bool is_fwd, const char* q, const char* api_key, 
+                   ocgeo_params_t* params, ocgeo_response_t* response)
+{
+    ocgeo_client_t* client = ocgeo_client_new(api_key, NULL);
+    if (client == NULL) {
+        if (response)
+            memset(response, 0, sizeof(ocgeo_response_t));
+        return false;
+    }
+    bool ok = do_request(client, is_fwd, q, params, response);
+    ocgeo_client_free(client);
+    return ok;
+}
+
+ocgeo_params_t ocgeo_default_params(void)
+{
+
+    ocgeo_params_t params = {0};
+    params.proximity = ocgeo_invalid_point;
+    params.bounds.southwest = ocgeo_invalid_point;
+    params.bounds.northeast = ocgeo_invalid_point;
+    return params;
+}
+
+bool ocgeo_forward(const char* q, const char* api_key,
+		ocgeo_params_t* params, ocgeo_response_t* response)
+{
+    return do_oneshot_request(true, q, api_key, params, response);
+}
+
+bool ocgeo_reverse(double lat, double lng, const char* api_key,
+        ocgeo_params_t* params, ocgeo_response_t* response)
+{
+    sds q = sdsempty();
+    q = sdscatprintf(q, "%.8F,%.8F", lat, lng);
+    bool ok = do_oneshot_request(false, q, api_key, params, response);
+    sdsfree(q);
+    return ok;
+}
+
+ocgeo_client_t* ocgeo_client_new(const char* api_key, ocgeo_params_t* params)
+{
+    if (api_key == NULL)
+        return NULL;
+
+    ocgeo_client_t* client = calloc(1, sizeof(ocgeo_client_t));
+    if (client == NULL)
+        return NULL;
+    client->user_agent = make_user_agent();
+    client->curl = new_curl_handle(client->user_agent);
+    if (client->curl == NULL) {
+        sdsfree(client->user_agent);
+        free(client);
+        return NULL;
+    }
+    client->api_key = sdsnew(api_key);
+    client->params = params ? *params : ocgeo_default_params();
+    client->rng = random_seed(client);
+    return client;
+}
+
+void ocgeo_client_free(ocgeo_client_t* client)
+{
+    if (client == NULL)
+        return;
+    ocgeo_client_disable_hedging(client);
+    curl_easy_cleanup(client->curl);
+    sdsfree(client->body.data);
+    sdsfree(client->api_key);
+    sdsfree(client->user_agent);
+    free(client);
+}
+
+bool ocgeo_client_enable_hedging(ocgeo_client_t* client, double percentile, double max_extra_ratio)
+{
+    if (client == NULL || percentile <= 0 || percentile > 100 || max_extra_ratio <= 0)
+        return false;
+    if (client->hedging == NULL) {
+        client->hedging = calloc(1, sizeof(struct hedging));
+        client->multi = curl_multi_init();
+        client->hedge_curl = new_curl_handle(client->user_agent);
+        if (client->hedging == NULL || client->multi == NULL || client->hedge_curl == NULL) {
+            ocgeo_client_disable_hedging(client);
+            return false;
+        }
+    }
+    client->hedging->percentile = percentile;
+    client->hedging->max_extra_ratio = max_extra_ratio;
+    return true;
+}
+
+void ocgeo_client_disable_hedging(ocgeo_client_t* client)
+{
+    if (client == NULL)
+        return;
+    if (client->hedge_curl)
+        curl_easy_cleanup(client->hedge_curl);
+    if (client->multi)
+        curl_multi_cleanup(client->multi);
+    free(client->hedging);
+    sdsfree(client->hedge_body.data);
+    client->hedge_body.data = NULL;
+    client->hedge_curl = NULL;
+    client->multi = NULL;
+    client->hedging = NULL;
+}
+
+bool ocgeo_client_forward(ocgeo_client_t* client, const char* q,
+        ocgeo_params_t* params, ocgeo_response_t* response)
+{
+    if (client == NULL)
+        return false;
+    if (params == NULL)
+        params = &client->params;
+    return do_request(client, true, q, params, response);
+}
+
+bool ocgeo_client_reverse(ocgeo_client_t* client, double lat, double lng,
+        ocgeo_params_t* params, ocgeo_response_t* response)
+{
+    if (client == NULL)
+        return false;
+    if (params == NULL)
+        params = &client->params;
+    sds q = sdsempty();
+    q = sdscatprintf(q, "%.8F,%.8F", lat, lng);
+    bool ok = do_request(client, false, q, params, response);
+    sdsfree(q);
+    return ok;
+}
+
+/*
+ * The asynchronous "batch" API, on top of libcurl's multi interface.
+ * Submitted queries are kept in a FIFO queue and at most `max_in_flight` of
+ * them are being transferred at any time. The "easy" handles are kept in a
+ * pool and reused, so connections are reused too.
+ */
+struct ocgeo_batch_job {
+    struct ocgeo_batch_job* next;
+    bool is_fwd;
+    sds query;
+    ocgeo_params_t params;
+    ocgeo_batch_callback_t callback;
+    void* callback_data;
+
+    int attempts;
+    double first_start; /* when the first attempt started */
+    double not_before; /* when to retry, for jobs in the `delayed` list */
+
+    /* The following are valid only when the job is "in flight": */
+    int slot; /* index in the `running` array of the batch */
+    CURL* curl;
+    sds url;
+    struct http_response r;
+};
+
+struct ocgeo_batch {
+    CURLM* multi;
+    sds api_key;
+    sds user_agent;
+    ocgeo_params_t params;
+
+    /* queued jobs, not yet started: */
+    struct ocgeo_batch_job* head;
+    struct ocgeo_batch_job* tail;
+    int queued;
+
+    /* jobs waiting to be retried: */
+    struct ocgeo_batch_job* delayed;
+    int delayed_count;
+    double retry_wait; /* secs until the first delayed job is due */
+    uint64_t rng;
+
+    /* jobs in flight, there are `in_flight` of them: */
+    struct ocgeo_batch_job** running;
+    int in_flight;
+    int max_in_flight;
+    bool http2;
+    bool h2c; /* HTTP/2 with "prior knowledge" for the plain "http" servers */
+    double rate_wait; /* secs to wait until the rate limiter allows the next job */
+
+    /* pool of "easy" handles not currently used: */
+    CURL** idle;
+    int idle_count;
+    /* and of the receive buffers of the finished jobs, for reuse: */
+    sds* buffers;
+    int buffer_count;
 };
 
-static size_t
-write_callback(char *ptr, size_t size, size_t nmemb, void *userdata)
+static void
+batch_job_free(struct ocgeo_batch_job* job)
 {
-    struct http_response* r = userdata;
-    r->data = sdscatlen(r->data, ptr, size*nmemb);
-    return nmemb;
+    sdsfree(job->query);
+    sdsfree(job->url);
+    sdsfree(job->r.data);
+    free(job);
 }
 
-#define JSON_INT_VALUE(json) ((json) == NULL || cJSON_IsNull(json) ? 0 : (json)->valueint)
-#define JSON_OBJ_GET_STR(obj,name) (cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(obj,name)))
-#define JSON_OBJ_GET_INT(obj,name) (cJSON_GetObjectItemCaseSensitive(obj,name)->valueint)
+/* Get a receive buffer from the pool, or a new one */
+static sds
+batch_get_buffer(ocgeo_batch_t* batch)
+{
+    return batch->buffer_count > 0 ? batch->buffers[--batch->buffer_count] : sdsempty();
+}
 
-static inline void
-parse_latlng(cJSON* json, ocgeo_latlng_t* latlng)
+/* Return the receive buffer of a finished job to the pool. There's at most
+   one buffer per job in flight, so the pool cannot overflow. */
+static void
+batch_put_buffer(ocgeo_batch_t* batch, struct ocgeo_batch_job* job)
 {
-    latlng->lat = cJSON_GetObjectItemCaseSensitive(json,"lat")->valuedouble;
-    latlng->lng = cJSON_GetObjectItemCaseSensitive(json,"lng")->valuedouble;
+    batch->buffers[batch->buffer_count++] = recycle_buffer(job->r.data);
+    job->r.data = NULL;
 }
 
-static int
-parse_response_json(cJSON* json, ocgeo_response_t* response)
+/* Remove the job from the running ones and return its handle to the pool */
+static void
+batch_stop_job(ocgeo_batch_t* batch, struct ocgeo_batch_job* job)
 {
-    cJSON* obj = NULL;
+    curl_multi_remove_handle(batch->multi, job->curl);
+    /* The pool has room for `max_in_flight` handles, so this cannot overflow: */
+    batch->idle[batch->idle_count++] = job->curl;
+    job->curl = NULL;
 
-    memset(response, 0, sizeof(ocgeo_response_t));
-    response->results = NULL;
-    response->internal = json;
+    struct ocgeo_batch_job* last = batch->running[--batch->in_flight];
+    batch->running[job->slot] = last;
+    last->slot = job->slot;
+}
 
-    obj = cJSON_GetObjectItemCaseSensitive(json, "status");
-    assert(obj);
-    response->status.code = JSON_OBJ_GET_INT(obj,"code");
-    response->status.message = JSON_OBJ_GET_STR(obj,"message");
+/* Call the job's callback (or just cleanup the response if there's none) and
+   free the job */
+static void
+batch_complete_job(struct ocgeo_batch_job* job, bool ok, ocgeo_response_t* response)
+{
+    if (job->callback)
+        job->callback(ok, response, job->callback_data);
+    else
+        ocgeo_response_cleanup(response);
+    batch_job_free(job);
+}
 
-    /* Rate information, may not returned (e.g. for paying customers): */
-    obj = cJSON_GetObjectItem(json, "rate");
-    if (obj) {
-        response->rateInfo.limit = JSON_OBJ_GET_INT(obj,"limit");
-        response->rateInfo.remaining = JSON_OBJ_GET_INT(obj,"remaining");
-        response->rateInfo.reset = JSON_OBJ_GET_INT(obj,"reset");
+static struct ocgeo_batch_job*
+batch_dequeue(ocgeo_batch_t* batch)
+{
+    struct ocgeo_batch_job* job = batch->head;
+    batch->head = job->next;
+    if (batch->head == NULL)
+        batch->tail = NULL;
+    batch->queued--;
+    job->next = NULL;
+    return job;
+}
+
+/* Move the delayed jobs that are due for a retry to the front of the queue */
+static void
+batch_requeue_delayed(ocgeo_batch_t* batch)
+{
+    double now = monotonic_time();
+    struct ocgeo_batch_job** p = &batch->delayed;
+    batch->retry_wait = 0;
+    while (*p != NULL) {
+        struct ocgeo_batch_job* job = *p;
+        if (job->not_before <= now) {
+            *p = job->next;
+            batch->delayed_count--;
+            job->next = batch->head;
+            batch->head = job;
+            if (batch->tail == NULL)
+                batch->tail = job;
+            batch->queued++;
+        }
+        else {
+            double wait = job->not_before - now;
+            if (batch->retry_wait == 0 || wait < batch->retry_wait)
+                batch->retry_wait = wait;
+            p = &job->next;
+        }
     }
+}
 
-    obj = cJSON_GetObjectItem(json, "total_results");
-    assert(obj);
-    response->total_results = JSON_INT_VALUE(obj);
-    if (response->total_results <= 0) {
-        return 0;
+/* Complete the job at the head of the queue, if its reply is in the cache.
+   Otherwise the job keeps the URL built for the lookup, for its transfer. */
+static bool
+batch_cached_job(ocgeo_batch_t* batch)
+{
+    struct ocgeo_batch_job* job = batch->head;
+    /* With a URL the job has already been looked up, e.g. before waiting for
+       the rate limiter: */
+    if ((job->params.cache == NULL && job->params.disk_cache == NULL) || job->url != NULL)
+        return false;
+    job->url = build_url(sdsempty(), job->is_fwd, job->query, batch->api_key, &job->params);
+    job->r.data = batch_get_buffer(batch);
+    if (!cached_reply(&job->params, job->url, &job->r.data)) {
+        batch_put_buffer(batch, job);
+        return false;
     }
 
-    response->results = malloc(response->total_results * sizeof(ocgeo_result_t));
-    obj = cJSON_GetObjectItemCaseSensitive(json, "results");
-    assert(obj);
+    batch_dequeue(batch);
+    ocgeo_response_t response;
+    memset(&response, 0, sizeof(ocgeo_response_t));
+    bool ok = handle_cached_body(&job->r, job->url, &job->params, &response);
+    batch_put_buffer(batch, job);
+    job->url = NULL;
+    batch_complete_job(job, ok, &response);
+    return true;
+}
 
-    cJSON* result_js;
-    int k = 0;
-    ocgeo_result_t proto = {0};
-    for (result_js = obj->child; result_js!= NULL; result_js = result_js->next, k++) {
-        ocgeo_result_t* result = response->results + k;
-        *result = proto; /* initialize with 0/NULL values */
-        result->internal = result_js;
+/* Move jobs from the queue to the multi handle, up to `max_in_flight` and as
+   long as the rate limiter allows. The jobs whose reply is in the cache are
+   completed instead. */
+static void
+batch_start_jobs(ocgeo_batch_t* batch)
+{
+    if (batch->delayed != NULL)
+        batch_requeue_delayed(batch);
+    batch->rate_wait = 0;
+    while (batch->head != NULL && batch->in_flight < batch->max_in_flight) {
+        if (batch_cached_job(batch))
+            continue;
+        CURL* curl = batch->idle_count > 0 ?
+            batch->idle[--batch->idle_count] : new_curl_handle(batch->user_agent);
+        if (curl == NULL)
+            return;
 
-        result->confidence = JSON_OBJ_GET_INT(result_js,"confidence");
-        result->formatted = JSON_OBJ_GET_STR(result_js,"formatted");
+        ocgeo_params_t* params = &batch->head->params;
+        if (params->rate_limiter) {
+            double wait;
+            enum rate_limit_result result = rate_limiter_take(params->rate_limiter, false, &wait);
+            if (result == RATE_LIMIT_WAIT && !params->rate_limit_nowait) {
+                /* We can't block, so try again after `wait` secs: */
+                batch->idle[batch->idle_count++] = curl;
+                batch->rate_wait = wait;
+                return;
+            }
+            if (result != RATE_LIMIT_ACQUIRED) {
+                batch->idle[batch->idle_count++] = curl;
+                ocgeo_response_t response;
+                memset(&response, 0, sizeof(ocgeo_response_t));
+                set_local_status(&response, OCGEO_CODE_RATE_LIMITED);
+                batch_complete_job(batch_dequeue(batch), false, &response);
+                continue;
+            }
+        }
 
-        cJSON* bounds_js = cJSON_GetObjectItemCaseSensitive(result_js, "bounds");
-        // assert(bounds_js);
-        if (bounds_js) {
-            result->bounds = calloc(1, sizeof(ocgeo_latlng_bounds_t));
-            parse_latlng(cJSON_GetObjectItem(bounds_js, "northeast"), &result->bounds->northeast);
-            parse_latlng(cJSON_GetObjectItem(bounds_js, "southwest"), &result->bounds->southwest);
+        struct ocgeo_batch_job* job = batch_dequeue(batch);
+        if (job->attempts == 0)
+            job->first_start = monotonic_time();
+        job->curl = curl;
+        if (job->url == NULL)
+            job->url = build_url(sdsempty(), job->is_fwd, job->query, batch->api_key, &job->params);
+        log("URL=%s\n", job->url);
+        job->r.data = batch_get_buffer(batch);
+        curl_easy_setopt(curl, CURLOPT_URL, job->url);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &job->r);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, &job->r);
+        curl_easy_setopt(curl, CURLOPT_PRIVATE, job);
+        long remaining_ms = 0;
+        if (job->params.retry.deadline_ms > 0) {
+            remaining_ms = job->params.retry.deadline_ms -
+                (long) ((monotonic_time() - job->first_start) * 1000);
+            if (remaining_ms <= 0)
+                remaining_ms = 1;
+        }
+        set_request_options(curl, &job->params, remaining_ms);
+        if (batch->http2) {
+            /* HTTP/2 is negotiated during the TLS handshake, so a plain "http"
+               server gets HTTP/1.1, unless it's known to speak HTTP/2 (h2c) */
+            const char* server = job->params.api_server ? job->params.api_server : OCG_API_SERVER;
+            curl_easy_setopt(curl, CURLOPT_HTTP_VERSION,
+                batch->h2c && strncmp(server, "http:", 5) == 0 ?
+                CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE : CURL_HTTP_VERSION_2TLS);
+            /* Wait for a connection to multiplex over, instead of opening a new one: */
+            curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
         }
+        curl_multi_add_handle(batch->multi, curl);
+        job->slot = batch->in_flight;
+        batch->running[batch->in_flight++] = job;
+    }
+}
 
-        cJSON* geom_js = cJSON_GetObjectItemCaseSensitive(result_js, "geometry");
-        // assert(geom_js);
-        if (geom_js)
-            parse_latlng(geom_js, &result->geometry);
-        else
-            result->geometry = ocgeo_invalid_point;
-        
-
-        cJSON* comp_js = cJSON_GetObjectItemCaseSensitive(result_js, "components");
-        assert(comp_js);
-        result->ISO_alpha2 = JSON_OBJ_GET_STR(comp_js, "ISO_3166-1_alpha-2");
-        result->ISO_alpha3 = JSON_OBJ_GET_STR(comp_js, "ISO_3166-1_alpha-3");
-        result->type = JSON_OBJ_GET_STR(comp_js, "_type");
-        result->category = JSON_OBJ_GET_STR(comp_js, "_category");
-        result->city = JSON_OBJ_GET_STR(comp_js, "city");
-        result->city_district = JSON_OBJ_GET_STR(comp_js, "city_district");
-        result->continent = JSON_OBJ_GET_STR(comp_js, "continent");
-        result->country = JSON_OBJ_GET_STR(comp_js, "country");
-        result->country_code = JSON_OBJ_GET_STR(comp_js, "country_code");
-        result->county = JSON_OBJ_GET_STR(comp_js, "county");
-        result->house_number = JSON_OBJ_GET_STR(comp_js, "house_number");
-        result->neighbourhood = JSON_OBJ_GET_STR(comp_js, "neighbourhood");
-        result->political_union = JSON_OBJ_GET_STR(comp_js, "political_union");
-        result->postcode = JSON_OBJ_GET_STR(comp_js, "postcode");
-        result->road = JSON_OBJ_GET_STR(comp_js, "road");
-        result->state = JSON_OBJ_GET_STR(comp_js, "state");
-        result->state_district = JSON_OBJ_GET_STR(comp_js, "state_district");
-        result->suburb = JSON_OBJ_GET_STR(comp_js, "suburb");
-
-        /* Parse annotations, if exist */
-        cJSON* ann_js = cJSON_GetObjectItemCaseSensitive(result_js, "annotations");
-        if (ann_js) {
-            result->callingcode = JSON_OBJ_GET_INT(ann_js,"callingcode");
-            
-            cJSON* tm_ann = cJSON_GetObjectItemCaseSensitive(ann_js, "timezone");
-            if (tm_ann) {
-                ocgeo_ann_timezone_t* timezone = calloc(1, sizeof(ocgeo_ann_timezone_t));
-                timezone->name = JSON_OBJ_GET_STR(tm_ann, "name");
-                timezone->short_name = JSON_OBJ_GET_STR(tm_ann, "short_name");
-                timezone->offset_string = JSON_OBJ_GET_STR(tm_ann, "offset_string");
-                timezone->offset_sec = JSON_OBJ_GET_INT(tm_ann,"offset_sec");
-                timezone->now_in_dst = JSON_OBJ_GET_INT(tm_ann,"now_in_dst") == 1;
-                result->timezone = timezone;
-            }
-            cJSON* ri_ann = cJSON_GetObjectItemCaseSensitive(ann_js, "roadinfo");
-            if (ri_ann) {
-                ocgeo_ann_roadinfo_t* roadinfo = calloc(1, sizeof(ocgeo_ann_roadinfo_t));
-                roadinfo->drive_on = JSON_OBJ_GET_STR(ri_ann, "drive_on");
-                roadinfo->speed_in = JSON_OBJ_GET_STR(ri_ann, "speed_in");
-                roadinfo->road = JSON_OBJ_GET_STR(ri_ann, "road");
-                roadinfo->road_type = JSON_OBJ_GET_STR(ri_ann, "road_type");
-                roadinfo->surface = JSON_OBJ_GET_STR(ri_ann, "surface");
-                result->roadinfo = roadinfo;
-            }
-            cJSON* cur_ann = cJSON_GetObjectItemCaseSensitive(ann_js, "currency");
-            if (cur_ann) {
-                ocgeo_ann_currency_t* currency = calloc(1, sizeof(ocgeo_ann_currency_t));
-                currency->name = JSON_OBJ_GET_STR(cur_ann, "name");
-                currency->iso_code = JSON_OBJ_GET_STR(cur_ann, "iso_code");
-                currency->symbol = JSON_OBJ_GET_STR(cur_ann, "symbol");
-                currency->decimal_mark = JSON_OBJ_GET_STR(cur_ann, "decimal_mark");
-                currency->thousands_separator = JSON_OBJ_GET_STR(cur_ann, "thousands_separator");
-                result->currency = currency;
-            }
-            result->geohash = JSON_OBJ_GET_STR(ann_js, "geohash");
-            cJSON* w3w_ann = cJSON_GetObjectItemCaseSensitive(ann_js, "what3words");
-            if (w3w_ann) {
-                result->what3words = JSON_OBJ_GET_STR(w3w_ann, "words");
-            }
+/* Process the completed transfers, calling their callbacks */
+static void
+batch_finish_jobs(ocgeo_batch_t* batch)
+{
+    CURLMsg* msg;
+    int msgs_left;
+    while ((msg = curl_multi_info_read(batch->multi, &msgs_left)) != NULL) {
+        if (msg->msg != CURLMSG_DONE)
+            continue;
+        struct ocgeo_batch_job* job = NULL;
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**) &job);
+        CURLcode res = msg->data.result;
+
+        ocgeo_response_t response;
+        memset(&response, 0, sizeof(ocgeo_response_t));
+        get_transfer_info(job->curl, &response.transfer);
+        batch_stop_job(batch, job);
+        bool ok = false;
+        if (res == CURLE_OK) {
+            ok = handle_response_body(&job->r, job->url, &job->params, sample_body(&job->params, &batch->rng), &response);
+        }
+        else {
+            set_transfer_error(&response, res);
+            response.url = job->url;
+        }
+        batch_put_buffer(batch, job);
+        job->url = NULL;
+
+        double delay = retry_delay(&job->params.retry, ++job->attempts,
+                                   monotonic_time() - job->first_start, &response, &batch->rng);
+        if (delay >= 0) {
+            log("Retrying (status=%d) in %.3f secs\n", response_status(&response), delay);
+            ocgeo_response_cleanup(&response);
+            job->not_before = monotonic_time() + delay;
+            job->next = batch->delayed;
+            batch->delayed = job;
+            batch->delayed_count++;
+            continue;
         }
+        batch_complete_job(job, ok, &response);
     }
-    return 0;
 }
 
 static bool
-do_request(bool is_fwd, const char* q, const char* api_key, 
-           ocgeo_params_t* params, ocgeo_response_t* response)
+batch_submit(ocgeo_batch_t* batch, bool is_fwd, sds query, ocgeo_params_t* params,
+             ocgeo_batch_callback_t callback, void* callback_data)
 {
-    if (params == NULL) {
-        ocgeo_params_t params = ocgeo_default_params();
-        return do_request(is_fwd, q, api_key, &params, response);
+    struct ocgeo_batch_job* job = calloc(1, sizeof(struct ocgeo_batch_job));
+    if (job == NULL) {
+        sdsfree(query);
+        return false;
     }
+    job->is_fwd = is_fwd;
+    job->query = query;
+    job->params = params ? *params : batch->params;
+    job->callback = callback;
+    job->callback_data = callback_data;
 
-    /* Make sure that we have a proper response: */
-    if (response == NULL)
-        return false;
+    if (batch->tail)
+        batch->tail->next = job;
+    else
+        batch->head = job;
+    batch->tail = job;
+    batch->queued++;
+    return true;
+}
 
-    CURL *curl = curl_easy_init();
-    if (curl == NULL) {
-        return false;
+ocgeo_batch_t* ocgeo_batch_new(const char* api_key, ocgeo_params_t* params, int max_in_flight)
+{
+    if (api_key == NULL)
+        return NULL;
+    if (max_in_flight < 1)
+        max_in_flight = 1;
+
+    ocgeo_batch_t* batch = calloc(1, sizeof(ocgeo_batch_t));
+    if (batch == NULL)
+        return NULL;
+    batch->multi = curl_multi_init();
+    batch->running = calloc(max_in_flight, sizeof(struct ocgeo_batch_job*));
+    batch->idle = calloc(max_in_flight, sizeof(CURL*));
+    batch->buffers = calloc(max_in_flight, sizeof(sds));
+    if (batch->multi == NULL || batch->running == NULL || batch->idle == NULL ||
+        batch->buffers == NULL) {
+        if (batch->multi)
+            curl_multi_cleanup(batch->multi);
+        free(batch->running);
+        free(batch->idle);
+        free(batch->buffers);
+        free(batch);
+        return NULL;
     }
+    /* Never open more connections than the transfers we allow: */
+    curl_multi_setopt(batch->multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long) max_in_flight);
+    batch->max_in_flight = max_in_flight;
+    batch->api_key = sdsnew(api_key);
+    batch->user_agent = make_user_agent();
+    batch->params = params ? *params : ocgeo_default_params();
+    batch->rng = random_seed(batch);
+    return batch;
+}
 
-    // Build URL:
-    char* q_escaped = curl_easy_escape(curl, q, 0);
-    sds url = sdsempty();
-    url = sdscatprintf(url, "%s?q=%s&key=%s", OCG_API_SERVER, q_escaped, api_key);
-    curl_free(q_escaped);
-    if (params->abbrv)
-        url = sdscat(url, "&abbrv=1");
-    if (is_fwd && params->countrycode)
-        url = sdscatprintf(url, "&countrycode=%s", params->countrycode);
-    if (params->language)
-        url = sdscatprintf(url, "&language=%s", params->language);
-    if (params->limit)
-        url = sdscatprintf(url, "&limit=%d", params->limit);
-    if (params->min_confidence)
-        url = sdscatprintf(url, "&min_confidence=%d", params->min_confidence);
-    url = sdscatprintf(url, "&no_annotations=%d", params->no_annotations ? 1 : 0);
-    if (params->no_dedupe)
-        url = sdscat(url, "&no_dedupe=1");
-    if (params->no_record)
-        url = sdscat(url, "&no_record=1");
-    if (is_fwd && params->roadinfo)
-        url = sdscat(url, "&roadinfo=1");
-    if (is_fwd && ocgeo_is_valid_latlng(params->proximity))
-        url = sdscatprintf(url, "&proximity=%.8F,%.8F", params->proximity.lat, params->proximity.lng);
+void ocgeo_batch_free(ocgeo_batch_t* batch)
+{
+    if (batch == NULL)
+        return;
 
-    /* The value of the bounds parameter should be specified as two coordinate
-       points forming the south-west and north-east corners of a bounding box.
-       For example: bounds=-0.563160,51.280430,0.278970,51.683979 (min lon, min
-       lat, max lon, max lat). */
-    if (ocgeo_is_valid_bounds(&params->bounds))
-        url = sdscatprintf(url, "&bounds=%.8F,%.8F,%.8F,%.8F", 
-            params->bounds.southwest.lng, params->bounds.southwest.lat, 
-            params->bounds.northeast.lng, params->bounds.northeast.lat);
+    /* Abort any transfers in progress and discard queued jobs: */
+    while (batch->in_flight > 0) {
+        struct ocgeo_batch_job* job = batch->running[0];
+        batch_stop_job(batch, job);
+        batch_job_free(job);
+    }
+    struct ocgeo_batch_job* job;
+    while ((job = batch->head) != NULL) {
+        batch->head = job->next;
+        batch_job_free(job);
+    }
+    while ((job = batch->delayed) != NULL) {
+        batch->delayed = job->next;
+        batch_job_free(job);
+    }
 
-    log("URL=%s\n", url);
-	response->url = url;
+    for (int i = 0; i < batch->idle_count; ++i)
+        curl_easy_cleanup(batch->idle[i]);
+    curl_multi_cleanup(batch->multi);
+    for (int i = 0; i < batch->buffer_count; ++i)
+        sdsfree(batch->buffers[i]);
+    free(batch->running);
+    free(batch->idle);
+    free(batch->buffers);
+    sdsfree(batch->api_key);
+    sdsfree(batch->user_agent);
+    free(batch);
+}
 
-    struct http_response r; r.data = sdsempty();
-    sds user_agent = sdsempty();
-    user_agent = sdscatprintf(user_agent, "c-ocgeo/%s (%s)", ocgeo_version, curl_version());
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_USERAGENT, user_agent);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &r);
-    CURLcode res = curl_easy_perform(curl);
-    curl_easy_cleanup(curl);
-    sdsfree(user_agent);
+bool ocgeo_batch_enable_http2(ocgeo_batch_t* batch, int max_streams, int max_connections)
+{
+    if (batch == NULL || !(curl_version_info(CURLVERSION_NOW)->features & CURL_VERSION_HTTP2))
+        return false;
+    curl_multi_setopt(batch->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#if LIBCURL_VERSION_NUM >= 0x074300 /* 7.67.0 */
+    if (max_streams > 0)
+        curl_multi_setopt(batch->multi, CURLMOPT_MAX_CONCURRENT_STREAMS, (long) max_streams);
+#endif
+    if (max_connections > 0)
+        curl_multi_setopt(batch->multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long) max_connections);
+    batch->http2 = true;
+    return true;
+}
 
-    if (res != CURLE_OK) {
-        sdsfree(r.data);
+bool ocgeo_batch_enable_h2c(ocgeo_batch_t* batch)
+{
+    if (batch == NULL || !batch->http2)
         return false;
-    }
+    batch->h2c = true;
+    return true;
+}
 
-    cJSON* json = cJSON_Parse(r.data);
-    sdsfree(r.data);
+bool ocgeo_batch_forward(ocgeo_batch_t* batch, const char* query, ocgeo_params_t* params,
+        ocgeo_batch_callback_t callback, void* callback_data)
+{
+    if (batch == NULL || query == NULL)
+        return false;
+    return batch_submit(batch, true, sdsnew(query), params, callback, callback_data);
+}
 
-    if (json == NULL)
+bool ocgeo_batch_reverse(ocgeo_batch_t* batch, double lat, double lng, ocgeo_params_t* params,
+        ocgeo_batch_callback_t callback, void* callback_data)
+{
+    if (batch == NULL)
         return false;
+    sds q = sdsempty();
+    q = sdscatprintf(q, "%.8F,%.8F", lat, lng);
+    return batch_submit(batch, false, q, params, callback, callback_data);
+}
 
-    if (params->dbg_callback != NULL) {
-        char* str = cJSON_Print(json);
-        params->dbg_callback(str, params->callback_data);
-        cJSON_free(str);
+int ocgeo_batch_pending(ocgeo_batch_t* batch)
+{
+    if (batch == NULL)
+        return 0;
+    return batch->queued + batch->in_flight + batch->delayed_count;
+}
+
+int ocgeo_batch_perform(ocgeo_batch_t* batch, int timeout_ms)
+{
+    if (batch == NULL)
+        return -1;
+
+    int running;
+    batch_start_jobs(batch);
+    if (curl_multi_perform(batch->multi, &running) != CURLM_OK)
+        return -1;
+    batch_finish_jobs(batch);
+    batch_start_jobs(batch);
+
+    if (timeout_ms > 0 && ocgeo_batch_pending(batch) > 0) {
+        /* Wait for network activity, or until the rate limiter allows the
+           next queued job to start, or a job is due for a retry: */
+        int wait_ms = timeout_ms;
+        if (batch->rate_wait > 0 && batch->rate_wait * 1000 < wait_ms)
+            wait_ms = (int) (batch->rate_wait * 1000) + 1;
+        if (batch->retry_wait > 0 && batch->retry_wait * 1000 < wait_ms)
+            wait_ms = (int) (batch->retry_wait * 1000) + 1;
+        if (batch->in_flight > 0) {
+            if (curl_multi_wait(batch->multi, NULL, 0, wait_ms, NULL) != CURLM_OK)
+                return -1;
+        }
+        else {
+            sleep_for(wait_ms / 1000.0);
+        }
+        batch_start_jobs(batch);
+        if (curl_multi_perform(batch->multi, &running) != CURLM_OK)
+            return -1;
+        batch_finish_jobs(batch);
+        batch_start_jobs(batch);
     }
+    return ocgeo_batch_pending(batch);
+}
 
-    parse_response_json(json, response);
-    return true;
+bool ocgeo_batch_run(ocgeo_batch_t* batch)
+{
+    int pending;
+    while ((pending = ocgeo_batch_perform(batch, 1000)) > 0)
+        ;
+    return pending == 0;
 }
 
-ocgeo_params_t ocgeo_default_params(void)
+bool ocgeo_response_parse(const char* json, ocgeo_response_t* response)
 {
+    memset(response, 0, sizeof(ocgeo_response_t));
+    return parse_reply(json, strlen(json), response, OCGEO_FIELDS_ALL) != NULL;
+}
 
-    ocgeo_params_t params = {0};
-    params.proximity = ocgeo_invalid_point;
-    params.bounds.southwest = ocgeo_invalid_point;
-    params.bounds.northeast = ocgeo_invalid_point;
-    return params;
+/*
+ * Compacting a response: the results, their annotations and their strings are
+ * copied into a new arena of exactly the needed size, and the old one (with
+ * the parsed JSON) is freed. The strings are packed together, without any
+ * alignment.
+ */
+#define COMPACT_MAX_STRINGS 36
+
+/* Collect the string fields of the result in `fields`, returns their number */
+static int
+result_strings(ocgeo_result_t* r, char** fields[COMPACT_MAX_STRINGS])
+{
+    char** own[] = {
+        &r->formatted, &r->ISO_alpha2, &r->ISO_alpha3, &r->type, &r->category,
+        &r->city, &r->city_district, &r->continent, &r->country, &r->country_code,
+        &r->county, &r->house_number, &r->neighbourhood, &r->political_union,
+        &r->postcode, &r->road, &r->state, &r->state_district, &r->suburb,
+        &r->geohash, &r->what3words
+    };
+    int n = sizeof(own) / sizeof(own[0]);
+    memcpy(fields, own, sizeof(own));
+    if (r->timezone) {
+        fields[n++] = &r->timezone->name;
+        fields[n++] = &r->timezone->short_name;
+        fields[n++] = &r->timezone->offset_string;
+    }
+    if (r->roadinfo) {
+        fields[n++] = &r->roadinfo->drive_on;
+        fields[n++] = &r->roadinfo->speed_in;
+        fields[n++] = &r->roadinfo->road;
+        fields[n++] = &r->roadinfo->road_type;
+        fields[n++] = &r->roadinfo->surface;
+    }
+    if (r->currency) {
+        fields[n++] = &r->currency->name;
+        fields[n++] = &r->currency->iso_code;
+        fields[n++] = &r->currency->symbol;
+        fields[n++] = &r->currency->decimal_mark;
+        fields[n++] = &r->currency->thousands_separator;
+    }
+    return n;
 }
 
-bool ocgeo_forward(const char* q, const char* api_key,
-		ocgeo_params_t* params, ocgeo_response_t* response)
+/* Copy the `size` bytes at `ptr` (if not NULL) into the pool */
+static void*
+compact_copy(struct arena* pool, const void* ptr, size_t size)
 {
-    return do_request(true, q, api_key, params, response);
+    if (ptr == NULL)
+        return NULL;
+    void* copy = arena_alloc(pool, size);
+    memcpy(copy, ptr, size);
+    return copy;
 }
 
-bool ocgeo_reverse(double lat, double lng, const char* api_key,
-        ocgeo_params_t* params, ocgeo_response_t* response)
+/* Copy the string into the `strings` area, advancing it */
+static char*
+compact_string(char** strings, const char* str)
 {
-    sds q = sdsempty();
-    q = sdscatprintf(q, "%.8F,%.8F", lat, lng);
-    bool ok = do_request(false, q, api_key, params, response);
-    sdsfree(q);
-    return ok;
+    if (str == NULL)
+        return NULL;
+    size_t size = strlen(str) + 1;
+    char* copy = memcpy(*strings, str, size);
+    *strings += size;
+    return copy;
+}
+
+bool ocgeo_response_compact(ocgeo_response_t* response)
+{
+    struct arena* arena = response->internal;
+    if (arena == NULL)
+        return true;
+
+    /* The interned strings are not copied, and the table should not change
+       in the meantime: */
+    pthread_mutex_lock(&intern_lock);
+    char** fields[COMPACT_MAX_STRINGS];
+    size_t size = ARENA_ROUND(response->total_results * sizeof(ocgeo_result_t));
+    size_t strings_size = response->status.message ? strlen(response->status.message) + 1 : 0;
+    for (int k = 0; k < response->total_results; ++k) {
+        ocgeo_result_t* r = response->results + k;
+        if (r->bounds)
+            size += ARENA_ROUND(sizeof(ocgeo_latlng_bounds_t));
+        if (r->timezone)
+            size += ARENA_ROUND(sizeof(ocgeo_ann_timezone_t));
+        if (r->roadinfo)
+            size += ARENA_ROUND(sizeof(ocgeo_ann_roadinfo_t));
+        if (r->currency)
+            size += ARENA_ROUND(sizeof(ocgeo_ann_currency_t));
+        int n = result_strings(r, fields);
+        for (int i = 0; i < n; ++i)
+            if (*fields[i] != NULL && !is_interned_locked(*fields[i]))
+                strings_size += strlen(*fields[i]) + 1;
+    }
+
+    struct arena* pool = arena_new_exact(size + ARENA_ROUND(strings_size));
+    if (pool == NULL) {
+        pthread_mutex_unlock(&intern_lock);
+        return false;
+    }
+    char* strings = arena_alloc(pool, strings_size);
+    response->status.message = compact_string(&strings, response->status.message);
+    ocgeo_result_t* results = compact_copy(pool, response->results,
+        response->total_results * sizeof(ocgeo_result_t));
+    for (int k = 0; k < response->total_results; ++k) {
+        ocgeo_result_t* r = results + k;
+        r->internal = NULL;
+        r->bounds = compact_copy(pool, r->bounds, sizeof(ocgeo_latlng_bounds_t));
+        r->timezone = compact_copy(pool, r->timezone, sizeof(ocgeo_ann_timezone_t));
+        r->roadinfo = compact_copy(pool, r->roadinfo, sizeof(ocgeo_ann_roadinfo_t));
+        r->currency = compact_copy(pool, r->currency, sizeof(ocgeo_ann_currency_t));
+        int n = result_strings(r, fields);
+        for (int i = 0; i < n; ++i)
+            if (!is_interned_locked(*fields[i]))
+                *fields[i] = compact_string(&strings, *fields[i]);
+    }
+    pthread_mutex_unlock(&intern_lock);
+    response->results = results;
+    response->internal = pool;
+    arena_free(arena);
+    return true;
+}
+
+void ocgeo_response_reset(ocgeo_response_t* r)
+{
+    if (r == NULL)
+        return;
+
+    struct arena* arena = arena_reset(r->internal);
+    sds url = r->url;
+    if (url != NULL)
+        sdsclear(url);
+    memset(r, 0, sizeof(ocgeo_response_t));
+    r->internal = arena;
+    r->url = url;
 }
 
 void ocgeo_response_cleanup(ocgeo_response_t* r)
@@ -317,75 +3343,191 @@ void ocgeo_response_cleanup(ocgeo_response_t* r)
     if (r == NULL)
         return;
 
-    ocgeo_result_t* result;
-    foreach_ocgeo_result(result, r) {
-        free(result->bounds);
-        free(result->timezone);
-        free(result->roadinfo);
-        free(result->currency);
-    }
+    /* Everything (but the URL) is in the arena: */
     r->total_results = 0;
-    free(r->results);
     r->results = NULL;
-    cJSON_Delete(r->internal);
+    arena_free(r->internal);
     r->internal = NULL;
 	sdsfree(r->url);
 	r->url = NULL;
 }
 
-static
-int str_to_maybe_int(sds s)
+/* A segment of a path: a key of an object, or an index of an array if it's
+   all digits */
+struct path_segment {
+    const char* key;
+    size_t len;
+    int index; /* -1 if it's a key */
+};
+
+static int
+segment_to_index(const char* seg, size_t len)
 {
+    if (len == 0)
+        return -1;
     int k = 0;
-    int len = sdslen(s);
-    for (int i=0; i<len; ++i) {
-        char c = s[i];
-        k += 10*k;
-        switch(c) {
-        case '0': break;
-        case '1': k += 1; break;
-        case '2': k += 2; break;
-        case '3': k += 3; break;
-        case '4': k += 4; break;
-        case '5': k += 5; break;
-        case '6': k += 6; break;
-        case '7': k += 7; break;
-        case '8': k += 8; break;
-        case '9': k += 9; break;
-        default:
+    for (size_t i = 0; i < len; ++i) {
+        if (seg[i] < '0' || seg[i] > '9')
             return -1;
-        }
+        if (k > (INT_MAX - 9) / 10)
+            return INT_MAX; /* too large to exist */
+        k = 10 * k + (seg[i] - '0');
     }
     return k;
 }
 
+static cJSON*
+get_json_child(cJSON* parent, const struct path_segment* seg)
+{
+    if (seg->index >= 0)
+        return cJSON_GetArrayItem(parent, seg->index);
+    for (cJSON* child = parent->child; child != NULL; child = child->next) {
+        if (child->string != NULL && strncmp(child->string, seg->key, seg->len) == 0 &&
+            child->string[seg->len] == '\0')
+            return child;
+    }
+    return NULL;
+}
+
+/* Follow the dot separated path, without splitting it first */
 static
 cJSON* get_json_field(cJSON* parent, const char* path)
 {
-    static const char* sep = ".";
+    const char* start = path;
+    cJSON* current = parent;
+    while (current != NULL) {
+        const char* end = strchr(start, '.');
+        struct path_segment seg;
+        seg.key = start;
+        seg.len = end ? (size_t) (end - start) : strlen(start);
+        seg.index = segment_to_index(start, seg.len);
+        current = get_json_child(current, &seg);
+        if (end == NULL)
+            break;
+        start = end + 1;
+    }
+    return current;
+}
+
+/* A compiled path is a single allocation: the segments followed by a copy
+   of the path, where the keys point to. */
+struct ocgeo_path {
+    int count;
+    struct path_segment segments[];
+};
 
-    if (parent == NULL)
+ocgeo_path_t* ocgeo_path_compile(const char* path)
+{
+    if (path == NULL)
         return NULL;
-    int n = 0;
-    sds* fields = sdssplitlen(path, strlen(path), sep, 1, &n);
-    if (fields == NULL)
+    size_t len = strlen(path);
+    int count = 1;
+    for (size_t i = 0; i < len; ++i)
+        if (path[i] == '.')
+            count++;
+
+    size_t size = sizeof(ocgeo_path_t) + count * sizeof(struct path_segment);
+    ocgeo_path_t* compiled = malloc(size + len + 1);
+    if (compiled == NULL)
         return NULL;
+    char* keys = (char*) compiled + size;
+    memcpy(keys, path, len + 1);
+    compiled->count = count;
 
-    cJSON* current = parent;
-    for (int k = 0; k<n && current != NULL; ++k) {
-        int index = str_to_maybe_int(fields[k]);
-        if (index >= 0)
-            current = cJSON_GetArrayItem(current, index);
-        else
-            current = cJSON_GetObjectItemCaseSensitive(current, fields[k]);
+    const char* start = keys;
+    for (int k = 0; k < count; ++k) {
+        const char* end = strchr(start, '.');
+        struct path_segment* seg = compiled->segments + k;
+        seg->key = start;
+        seg->len = end ? (size_t) (end - start) : strlen(start);
+        seg->index = segment_to_index(start, seg->len);
+        start = end + 1;
     }
-    sdsfreesplitres(fields, n);
+    return compiled;
+}
+
+void ocgeo_path_free(ocgeo_path_t* path)
+{
+    free(path);
+}
+
+static cJSON*
+get_json_path(cJSON* parent, const ocgeo_path_t* path)
+{
+    cJSON* current = parent;
+    for (int k = 0; k < path->count && current != NULL; ++k)
+        current = get_json_child(current, path->segments + k);
     return current;
 }
 
-const char* ocgeo_response_get_str(ocgeo_result_t* r, const char* path, bool* ok)
+/* Number of levels of the previous path that ocgeo_path_get_values keeps */
+#define OCGEO_MAX_SHARED_DEPTH 16
+
+static bool
+same_segment(const struct path_segment* a, const struct path_segment* b)
+{
+    return a->index == b->index && a->len == b->len && memcmp(a->key, b->key, a->len) == 0;
+}
+
+static void
+set_value(cJSON* js, ocgeo_value_t* value)
+{
+    memset(value, 0, sizeof(ocgeo_value_t));
+    if (js == NULL || cJSON_IsNull(js))
+        value->type = OCGEO_VALUE_MISSING;
+    else if (cJSON_IsString(js)) {
+        value->type = OCGEO_VALUE_STRING;
+        value->str = js->valuestring;
+    }
+    else if (cJSON_IsNumber(js)) {
+        value->type = OCGEO_VALUE_NUMBER;
+        value->integer = js->valueint;
+        value->dbl = js->valuedouble;
+    }
+    else if (cJSON_IsBool(js)) {
+        value->type = OCGEO_VALUE_BOOL;
+        value->integer = cJSON_IsTrue(js);
+    }
+    else
+        value->type = OCGEO_VALUE_OTHER;
+}
+
+int ocgeo_path_get_values(ocgeo_result_t* r, const ocgeo_path_t* const paths[], int count,
+                          ocgeo_value_t values[])
+{
+    /* nodes[i] is the node reached by the first i segments of the previous
+       path, for the first `levels` of them */
+    cJSON* nodes[OCGEO_MAX_SHARED_DEPTH + 1];
+    int levels = 0;
+    int found = 0;
+    nodes[0] = r->internal;
+    for (int k = 0; k < count; ++k) {
+        const ocgeo_path_t* path = paths[k];
+        int level = 0;
+        if (k > 0) {
+            const ocgeo_path_t* prev = paths[k - 1];
+            while (level < levels && level < path->count && level < prev->count &&
+                   same_segment(path->segments + level, prev->segments + level))
+                level++;
+        }
+        cJSON* node = nodes[level];
+        while (level < path->count && node != NULL) {
+            node = get_json_child(node, path->segments + level);
+            level++;
+            if (level <= OCGEO_MAX_SHARED_DEPTH)
+                nodes[level] = node;
+        }
+        levels = level < OCGEO_MAX_SHARED_DEPTH ? level : OCGEO_MAX_SHARED_DEPTH;
+        set_value(node, values + k);
+        if (values[k].type != OCGEO_VALUE_MISSING)
+            found++;
+    }
+    return found;
+}
+
+static const char*
+json_str_value(cJSON* js, bool* ok)
 {
-    cJSON* js = get_json_field(r->internal, path);
     if (js == NULL || cJSON_IsNull(js) || !cJSON_IsString(js)) {
         *ok = false;
         return NULL;
@@ -394,9 +3536,9 @@ const char* ocgeo_response_get_str(ocgeo_result_t* r, const char* path, bool* ok
     return js->valuestring;
 }
 
-int ocgeo_response_get_int(ocgeo_result_t* r, const char* path, bool* ok)
+static int
+json_int_value(cJSON* js, bool* ok)
 {
-    cJSON* js = get_json_field(r->internal, path);
     if (js == NULL || cJSON_IsNull(js) || !cJSON_IsNumber(js)) {
         *ok = false;
         return 0;
@@ -405,9 +3547,9 @@ int ocgeo_response_get_int(ocgeo_result_t* r, const char* path, bool* ok)
     return js->valueint;
 }
 
-double ocgeo_response_get_dbl(ocgeo_result_t* r, const char* path, bool* ok)
+static double
+json_dbl_value(cJSON* js, bool* ok)
 {
-    cJSON* js = get_json_field(r->internal, path);
     if (js == NULL || cJSON_IsNull(js) || !cJSON_IsNumber(js)) {
         *ok = false;
         return 0.0;
@@ -415,3 +3557,33 @@ double ocgeo_response_get_dbl(ocgeo_result_t* r, const char* path, bool* ok)
     *ok = true;
     return js->valuedouble;
 }
+
+const char* ocgeo_response_get_str(ocgeo_result_t* r, const char* path, bool* ok)
+{
+    return json_str_value(get_json_field(r->internal, path), ok);
+}
+
+int ocgeo_response_get_int(ocgeo_result_t* r, const char* path, bool* ok)
+{
+    return json_int_value(get_json_field(r->internal, path), ok);
+}
+
+double ocgeo_response_get_dbl(ocgeo_result_t* r, const char* path, bool* ok)
+{
+    return json_dbl_value(get_json_field(r->internal, path), ok);
+}
+
+const char* ocgeo_path_get_str(ocgeo_result_t* r, const ocgeo_path_t* path, bool* ok)
+{
+    return json_str_value(get_json_path(r->internal, path), ok);
+}
+
+int ocgeo_path_get_int(ocgeo_result_t* r, const ocgeo_path_t* path, bool* ok)
+{
+    return json_int_value(get_json_path(r->internal, path), ok);
+}
+
+double ocgeo_path_get_dbl(ocgeo_result_t* r, const ocgeo_path_t* path, bool* ok)
+{
+    return json_dbl_value(get_json_path(r->internal, path), ok);
+}
@@ -41,6 +41,10 @@ extern "C" {
 #define OCGEO_CODE_MANY_REQUESTS (429)	/* Too many requests (too quickly, rate limiting) */
 #define OCGEO_CODE_INTERNAL_ERROR (503)	/* Internal server error  */
 
+/* Codes set by the library itself, when the request was not (or could not be) completed: */
+#define OCGEO_CODE_RATE_LIMITED (-1)	/* Not sent, rate limited by the client side rate limiter */
+#define OCGEO_CODE_DEADLINE_EXCEEDED (-2)	/* Timed out, one of the time limits in the params was exceeded */
+
 typedef struct ocgeo_status {
 	int code;
 	char* message;
@@ -158,10 +162,41 @@ typedef struct ocgeo_result {
 	void* internal;
 } ocgeo_result_t;
 
+/*
+ * Information about the HTTP transfer of a response
+ */
+typedef struct ocgeo_transfer_info {
+	double total_time; /* in seconds */
+	long connects; /* new connections made, 0 if an existing one was reused */
+	long bytes; /* body bytes received, i.e. compressed if compression was used */
+	int http_version; /* 10 for HTTP/1.0, 11 for HTTP/1.1, 20 for HTTP/2, etc. (0 with libcurl < 7.50) */
+	int http_status; /* the HTTP status code of the reply */
+	bool from_cache; /* no transfer was made, the reply was in the cache */
+} ocgeo_transfer_info_t;
+
+/*
+ * Why a request failed, if it did. The stages are checked in the order given
+ * below, the first that failed is reported.
+ */
+#define OCGEO_ERROR_NONE      (0)
+#define OCGEO_ERROR_TRANSPORT (1) /* `code` is the CURLcode, e.g. 28 for a timeout */
+#define OCGEO_ERROR_HTTP      (2) /* `code` is the HTTP status, the body is not a reply of the API */
+#define OCGEO_ERROR_PARSE     (3) /* the reply is not valid JSON, see `offset` */
+#define OCGEO_ERROR_SCHEMA    (4) /* valid JSON but not a reply of the API, e.g. no "status" */
+#define OCGEO_ERROR_MEMORY    (5) /* the memory for the parsed reply could not be allocated */
+
+typedef struct ocgeo_error {
+	int stage; /* one of the OCGEO_ERROR_ values */
+	int code;
+	long offset; /* for parse errors, the byte offset in the body of the error */
+} ocgeo_error_t;
+
 typedef struct ocgeo_response {
 	/* Returned status */
 	ocgeo_status_t status;
     char* url; /* the actual URL used, based on the given params */
+	ocgeo_transfer_info_t transfer;
+	ocgeo_error_t error; /* kept in the response, so it's safe with many threads */
 
 	/* Rate information. If not returned (e.g. for paying customers)
 	   all its fields should be 0.
@@ -178,8 +213,96 @@ typedef struct ocgeo_response {
 		result!=(response)->results+(response)->total_results;\
 		result=result+1)
 
+/*
+ * The retry policy for requests that failed with a "transient" error, i.e.
+ * 408 (timeout), 429 (too many requests), or 503 (internal server error).
+ * The delay before each retry is a random value between 0 and
+ * `base_delay_ms * 2^(retry-1)`, capped at `max_delay_ms` ("full jitter"),
+ * so that concurrent clients do not retry all at the same time.
+ * If a 429 is returned because the quota has been exhausted, the request is
+ * retried after the quota's reset, unless that's later than `max_delay_ms`
+ * or the `deadline_ms` (if they are set).
+ * All the fields being 0 (the default) means no retries.
+ */
+typedef struct ocgeo_retry_policy {
+	int max_attempts; /* including the first one, so 0 or 1 means no retries */
+	int base_delay_ms;
+	int max_delay_ms; /* 0 means no cap */
+	int deadline_ms;  /* overall time budget for all the attempts, 0 means none */
+} ocgeo_retry_policy_t;
+
+/*
+ * The fields of `ocgeo_result_t` to fill in, for the `fields` mask of
+ * `ocgeo_params_t`. The fields that are not selected are left NULL (or 0, or
+ * an invalid point for the geometry).
+ */
+#define OCGEO_FIELD_FORMATTED       (1u << 0)
+#define OCGEO_FIELD_BOUNDS          (1u << 1)
+#define OCGEO_FIELD_GEOMETRY        (1u << 2)
+#define OCGEO_FIELD_CONFIDENCE      (1u << 3)
+/* The components: */
+#define OCGEO_FIELD_ISO_ALPHA2      (1u << 4)
+#define OCGEO_FIELD_ISO_ALPHA3      (1u << 5)
+#define OCGEO_FIELD_TYPE            (1u << 6)
+#define OCGEO_FIELD_CATEGORY        (1u << 7)
+#define OCGEO_FIELD_CITY            (1u << 8)
+#define OCGEO_FIELD_CITY_DISTRICT   (1u << 9)
+#define OCGEO_FIELD_CONTINENT       (1u << 10)
+#define OCGEO_FIELD_COUNTRY         (1u << 11)
+#define OCGEO_FIELD_COUNTRY_CODE    (1u << 12)
+#define OCGEO_FIELD_COUNTY          (1u << 13)
+#define OCGEO_FIELD_HOUSE_NUMBER    (1u << 14)
+#define OCGEO_FIELD_NEIGHBOURHOOD   (1u << 15)
+#define OCGEO_FIELD_POLITICAL_UNION (1u << 16)
+#define OCGEO_FIELD_POSTCODE        (1u << 17)
+#define OCGEO_FIELD_ROAD            (1u << 18)
+#define OCGEO_FIELD_STATE           (1u << 19)
+#define OCGEO_FIELD_STATE_DISTRICT  (1u << 20)
+#define OCGEO_FIELD_SUBURB          (1u << 21)
+/* The annotations: */
+#define OCGEO_FIELD_CALLINGCODE     (1u << 22)
+#define OCGEO_FIELD_TIMEZONE        (1u << 23)
+#define OCGEO_FIELD_ROADINFO        (1u << 24)
+#define OCGEO_FIELD_CURRENCY        (1u << 25)
+#define OCGEO_FIELD_GEOHASH         (1u << 26)
+#define OCGEO_FIELD_WHAT3WORDS      (1u << 27)
+
+#define OCGEO_FIELDS_COMPONENTS     (0x3FFFF0u)
+#define OCGEO_FIELDS_ANNOTATIONS    (0xFC00000u)
+#define OCGEO_FIELDS_ALL            (0xFFFFFFFu)
+
+/*
+ * A client side rate limiter, which can be shared by many requests (and
+ * threads) through the `rate_limiter` field of `ocgeo_params_t`.
+ */
+typedef struct ocgeo_rate_limiter ocgeo_rate_limiter_t;
+
+/*
+ * A cache of the replies, which can be shared by many requests (and threads)
+ * through the `cache` field of `ocgeo_params_t`.
+ */
+typedef struct ocgeo_cache ocgeo_cache_t;
+
+typedef struct ocgeo_cache_stats {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions; /* replies evicted to keep within the size limit */
+	size_t entries;
+	size_t bytes;
+} ocgeo_cache_stats_t;
+
+/*
+ * A persistent cache of the replies, in files, which can be shared by many
+ * requests (and threads and processes) through the `disk_cache` field of
+ * `ocgeo_params_t`.
+ */
+typedef struct ocgeo_disk_cache ocgeo_disk_cache_t;
+
 typedef struct ocgeo_params {
 	void* callback_data;
+	/* Called with every reply that is parsed, printed again as (indented)
+	   JSON. That is costly for large replies, see `body_callback` for
+	   getting the body as received instead. */
 	void (*dbg_callback)(const char*, void*);
 
 	/*
@@ -230,6 +353,93 @@ typedef struct ocgeo_params {
 	/* When true the behaviour of the geocoder is changed to 
 	   attempt to match the nearest road (as opposed to address). */
 	bool roadinfo;
+
+	/*
+	 * Library options (these are not sent to the API) :
+	 */
+
+	/* The URL of the API endpoint. If NULL (the default) the OpenCage API server is used. */
+	const char* api_server;
+
+	/* If not NULL, each request first needs to acquire a "token" from this
+	   rate limiter. By default the request waits until a token is available,
+	   but if `rate_limit_nowait` is true it fails immediately instead, with
+	   status code OCGEO_CODE_RATE_LIMITED. */
+	ocgeo_rate_limiter_t* rate_limiter;
+	bool rate_limit_nowait;
+
+	/* The retry policy, by default no retries */
+	ocgeo_retry_policy_t retry;
+
+	/* Time limits, a value of 0 (the default) means no limit. If any of them
+	   is exceeded the request fails with OCGEO_CODE_DEADLINE_EXCEEDED status.
+	   Total time allowed for the request (in millisecs), for each attempt if
+	   it's retried: */
+	int timeout_ms;
+	/* Time allowed for connecting to the server (in millisecs): */
+	int connect_timeout_ms;
+	/* Abort if the transfer speed is below `low_speed_limit` bytes/sec for
+	   `low_speed_time` secs: */
+	int low_speed_limit;
+	int low_speed_time;
+
+	/* By default the responses are requested in compressed form (gzip, or
+	   brotli and zstd if supported by libcurl) and transparently decompressed.
+	   Set this to true to receive them uncompressed: */
+	bool no_compression;
+
+	/* If true, the response given to a request is reused: the memory it has
+	   from a previous request (e.g. for the parsed JSON) is kept and reused
+	   for the new one, instead of being freed and allocated again. The
+	   response should be initialized to zeros before its first use, e.g.
+	   `ocgeo_response_t response = {0};`, and cleaned up after the last one
+	   with `ocgeo_response_cleanup`, see also `ocgeo_response_reset`. */
+	bool reuse_response;
+
+	/* Parse the results while the body of the response is received, instead
+	   of after it has been received in full. This overlaps the parsing with
+	   the transfer and the whole body is never kept in memory, which helps
+	   for large responses (e.g. with a `limit` of 100). It's not used for
+	   hedged requests (see `ocgeo_client_enable_hedging`) or in batches. */
+	bool streaming_parse;
+
+	/* The fields of the results to fill in, a combination of the OCGEO_FIELD_*
+	   values, e.g. `OCGEO_FIELD_GEOMETRY | OCGEO_FIELD_COUNTRY_CODE`. The
+	   rest are skipped when parsing. 0 (the default) means all of them. If no
+	   annotation is selected, the results are requested without annotations
+	   (as if `no_annotations` was set). */
+	unsigned int fields;
+
+	/* Compact the responses, see `ocgeo_response_compact` */
+	bool compact;
+
+	/* Point the fields of the results that have only a few distinct values
+	   (the country and continent related components, the `type`, the
+	   `category`, and most of the timezone, roadinfo, and currency
+	   annotations) to process wide "interned" copies, see `ocgeo_intern`.
+	   Along with `compact` this saves memory when keeping many results, and
+	   such fields can be compared by their pointers. */
+	bool intern_strings;
+
+	/* If not NULL, the successful replies are kept in this cache and the
+	   requests that are the same (same query, API key, and parameters that
+	   are sent to the server) are answered from it, without contacting the
+	   server or acquiring a token of the `rate_limiter`. The reply is parsed
+	   into the response as if it was received, but the `rateInfo` is zero
+	   and `transfer.from_cache` is true. See `ocgeo_cache_new`. */
+	ocgeo_cache_t* cache;
+	/* The same for a persistent cache, see `ocgeo_disk_cache_open`. If both
+	   are set, the memory cache is looked up first and the hits on disk are
+	   added to it. */
+	ocgeo_disk_cache_t* disk_cache;
+
+	/* Called with the body of 1 in `body_sample_rate` replies (all of them
+	   if it's 0 or 1) as received, before it's parsed, e.g. for audit
+	   logging. The replies are picked at random. The body is valid only
+	   during the call. A reply that is passed to it is not parsed while it's
+	   received, see `streaming_parse`. */
+	void (*body_callback)(const char* body, size_t length, void* data);
+	unsigned int body_sample_rate;
 } ocgeo_params_t;
 
 /*
@@ -245,7 +455,9 @@ ocgeo_params_t ocgeo_default_params(void);
 
 /* Make a forward request i.e. find information about an address, place etc.
    Returns false if there was an error contacting the server or parsing the
-   returned JSON reply.
+   returned JSON reply. If the request was not made at all, e.g. due to rate
+   limiting, the status code of the response is set to one of the (negative)
+   codes set by the library, e.g. OCGEO_CODE_RATE_LIMITED.
    You can supply NULL as `params` and the default values will be used
 */
 bool ocgeo_forward(const char* query, const char* api_key, ocgeo_params_t* params, ocgeo_response_t* response);
@@ -260,6 +472,225 @@ bool ocgeo_reverse(double lat, double lng, const char* api_key, ocgeo_params_t*
 /* Free the memory used by the response of a forward or reverse call */
 void ocgeo_response_cleanup(ocgeo_response_t* r);
 
+/* Empty the response, but keep its memory so that it can be reused by the
+   next request that has `reuse_response` set in its parameters. Please note
+   that the response's data (e.g. the strings of the results) are no longer
+   valid afterwards. The response should still be cleaned up when no longer
+   needed.
+*/
+void ocgeo_response_reset(ocgeo_response_t* r);
+
+/* Parse a JSON reply of the API (e.g. one that was saved before) into the
+   response, as if it was returned by a forward or reverse call. Returns false
+   if it's not valid JSON. As usual, `ocgeo_response_cleanup` should be called
+   afterwards.
+*/
+bool ocgeo_response_parse(const char* json, ocgeo_response_t* response);
+
+/* Keep only the parsed results of the response and release the rest, i.e.
+   the JSON document, so that it takes much less memory (e.g. for keeping
+   many responses around). The results and their strings are copied into a
+   single block of memory. Afterwards the `internal` field of the results is
+   NULL, so the "advanced" path API below finds nothing. Returns false if the
+   memory could not be allocated, and then the response is left as it was.
+*/
+bool ocgeo_response_compact(ocgeo_response_t* response);
+
+/* Returns the "interned" copy of the string: for equal strings the same
+   pointer is returned, which is valid until `ocgeo_global_cleanup` is called.
+   E.g. `result->country_code == ocgeo_intern("de")` for results parsed with
+   `intern_strings` set in their parameters. The table of the interned strings
+   is shared by all threads and has a fixed maximum size; if it's full NULL is
+   returned (and the fields of the results are no longer interned).
+*/
+const char* ocgeo_intern(const char* str);
+
+/*
+ * A "client" is a long lived object that keeps the underlying HTTP connection
+ * (and TLS session) open between requests, so it is much faster than calling
+ * `ocgeo_forward` or `ocgeo_reverse` repeatedly, which always start afresh.
+ * A client should not be used by multiple threads at the same time; create one
+ * per thread instead.
+ */
+typedef struct ocgeo_client ocgeo_client_t;
+
+/* Create a new client with the given API key. The `params` (which may be NULL)
+   are copied and used as the default parameters for the requests made by this
+   client. Please note that any strings referenced by `params` (e.g. `language`)
+   are not copied, so they should remain valid during the lifetime of the client.
+   Returns NULL on failure.
+*/
+ocgeo_client_t* ocgeo_client_new(const char* api_key, ocgeo_params_t* params);
+
+/* Free the client and close any open connections */
+void ocgeo_client_free(ocgeo_client_t* client);
+
+/* Make a forward request using the client. If `params` is NULL the client's
+   default parameters are used. Returns false if there was an error contacting
+   the server or parsing the returned JSON reply.
+*/
+bool ocgeo_client_forward(ocgeo_client_t* client, const char* query, ocgeo_params_t* params, ocgeo_response_t* response);
+
+/* Make a reverse request using the client. If `params` is NULL the client's
+   default parameters are used. Returns false if there was an error contacting
+   the server or parsing the returned JSON reply.
+*/
+bool ocgeo_client_reverse(ocgeo_client_t* client, double lat, double lng, ocgeo_params_t* params, ocgeo_response_t* response);
+
+/* Enable "hedged" requests for the client: if a request has not completed
+   after the `percentile` (e.g. 95) of the latencies seen so far by the client,
+   a second identical request is made and the first reply that arrives is used,
+   while the other request is cancelled. This cuts the "tail" latency at the
+   cost of some extra requests, which are limited to at most `max_extra_ratio`
+   (e.g. 0.05) of all the requests made. Note that hedged requests count
+   against your API quota and respect the rate limiter, if one is set.
+   Hedging starts only after some requests have been made, so that there's a
+   good estimate of the latency. Returns false on failure.
+*/
+bool ocgeo_client_enable_hedging(ocgeo_client_t* client, double percentile, double max_extra_ratio);
+
+/* Disable hedged requests for the client */
+void ocgeo_client_disable_hedging(ocgeo_client_t* client);
+
+/*
+ * Asynchronous "batch" API: many requests can be submitted and then processed
+ * concurrently, using libcurl's multi interface. At most `max_in_flight`
+ * requests are being made at any time, which also limits the number of open
+ * connections, so please set it to something that respects your plan's rate
+ * limits. The batch is driven by calling `ocgeo_batch_perform` (or
+ * `ocgeo_batch_run`) from a single thread.
+ */
+typedef struct ocgeo_batch ocgeo_batch_t;
+
+/* Called when a request completes. `ok` has the same meaning as the return
+   value of `ocgeo_forward`. The callback owns the response and should call
+   `ocgeo_response_cleanup` when done with it. New requests may be submitted
+   from inside the callback, but the batch should not be freed. */
+typedef void (*ocgeo_batch_callback_t)(bool ok, ocgeo_response_t* response, void* callback_data);
+
+/* Create a new batch. The `params` (which may be NULL) are copied and used as
+   the default parameters for the submitted requests. Returns NULL on failure.
+*/
+ocgeo_batch_t* ocgeo_batch_new(const char* api_key, ocgeo_params_t* params, int max_in_flight);
+
+/* Free the batch. Any requests still pending are aborted, without calling their
+   callbacks */
+void ocgeo_batch_free(ocgeo_batch_t* batch);
+
+/* Submit a forward request. The `params` (if not NULL) are copied. The request
+   will be made during a subsequent `ocgeo_batch_perform` call and its callback
+   will be called when completed. Returns false if the request could not be
+   submitted. */
+bool ocgeo_batch_forward(ocgeo_batch_t* batch, const char* query, ocgeo_params_t* params,
+        ocgeo_batch_callback_t callback, void* callback_data);
+
+/* Submit a reverse request, see `ocgeo_batch_forward` */
+bool ocgeo_batch_reverse(ocgeo_batch_t* batch, double lat, double lng, ocgeo_params_t* params,
+        ocgeo_batch_callback_t callback, void* callback_data);
+
+/* Enable the HTTP/2 transport mode for the batch: the requests in flight are
+   multiplexed over at most `max_connections` connections, with up to
+   `max_streams` concurrent requests ("streams") per connection. A value of 0
+   or less for these keeps libcurl's default. If the server does not support
+   HTTP/2, or is a plain "http" one, HTTP/1.1 is used as usual. This should be
+   called before submitting any requests. Returns false if HTTP/2 is not
+   supported by libcurl. */
+bool ocgeo_batch_enable_http2(ocgeo_batch_t* batch, int max_streams, int max_connections);
+
+/* Also use HTTP/2 for the plain "http" servers, without asking them first
+   ("h2c" with prior knowledge). Only for servers known to support it, e.g. a
+   local proxy or the stand-in server of the benchmarks: the requests to an
+   HTTP/1.1 only server fail. Call it after `ocgeo_batch_enable_http2`,
+   otherwise it returns false. */
+bool ocgeo_batch_enable_h2c(ocgeo_batch_t* batch);
+
+/* Make progress on the pending requests, waiting at most `timeout_ms` for
+   network activity, and call the callbacks of the completed ones. Returns the
+   number of requests still pending (queued or in flight), or -1 on error. */
+int ocgeo_batch_perform(ocgeo_batch_t* batch, int timeout_ms);
+
+/* Process all the pending requests, including any submitted by the callbacks,
+   until there's none left. Returns false on error. */
+bool ocgeo_batch_run(ocgeo_batch_t* batch);
+
+/* Number of requests queued or in flight */
+int ocgeo_batch_pending(ocgeo_batch_t* batch);
+
+/*
+ * Rate limiting: The rate limiter paces the requests so that they do not
+ * exceed `requests_per_sec` (allowing bursts of up to `burst` requests), and
+ * also keeps track of the remaining requests of the API quota (see
+ * `ocgeo_rate_info_t`), as returned in the responses, so that no requests are
+ * made after the quota has been exhausted and until it is reset.
+ * It is thread safe. Set `requests_per_sec` to 0 for enforcing only the quota.
+ */
+ocgeo_rate_limiter_t* ocgeo_rate_limiter_new(double requests_per_sec, int burst);
+void ocgeo_rate_limiter_free(ocgeo_rate_limiter_t* rl);
+
+/* Acquire a token for making a request. If `block` is true and there is no
+   token available, wait until there's one. Returns false if there is no token
+   available (and `block` is false), or the quota has been exhausted.
+   The library calls this automatically for the requests whose params have
+   the rate limiter set. */
+bool ocgeo_rate_limiter_acquire(ocgeo_rate_limiter_t* rl, bool block);
+
+/* Update the quota information, using the rate info of a response. The
+   library calls this automatically for the requests whose params have the
+   rate limiter set. */
+void ocgeo_rate_limiter_update(ocgeo_rate_limiter_t* rl, const ocgeo_rate_info_t* info);
+
+/*
+ * Caching: The cache keeps the bodies of the successful replies, up to a
+ * total of `max_bytes`, evicting the least recently used ones when needed.
+ * The requests made with a client, the one-shot functions, or a batch use it
+ * if it's set in their parameters. A reply is not parsed while it's received
+ * (see `streaming_parse`) when a cache is used.
+ * It is thread safe. It's split into `shards` parts (rounded up to a power of
+ * 2), each with its own lock and an equal part of `max_bytes`, so that many
+ * threads can use it at the same time. Note that a reply larger than the
+ * part of a shard, i.e. `max_bytes / shards`, is not kept: e.g. with 16
+ * shards a 1 MB cache does not keep the replies over 64 KB, such as those
+ * with a `limit` of 100 and annotations. With 0 `shards` they are at most
+ * OCGEO_CACHE_SHARDS (16), but fewer for a small cache so that each part is
+ * at least OCGEO_CACHE_MIN_SHARD_BYTES (1 MB).
+ */
+ocgeo_cache_t* ocgeo_cache_new(size_t max_bytes, int shards);
+void ocgeo_cache_free(ocgeo_cache_t* cache);
+
+/* Get the number of hits, misses, evictions, and the current size */
+void ocgeo_cache_get_stats(ocgeo_cache_t* cache, ocgeo_cache_stats_t* stats);
+
+/*
+ * Persistent caching: The disk cache keeps the bodies of the successful
+ * replies in the files `<path>.idx` (the index) and `<path>.log` (the
+ * replies), which are created with room for `max_bytes` of replies if they
+ * don't exist (otherwise `max_bytes` is ignored; with 0 they must exist).
+ * The files are mapped into
+ * memory, so a process that opens them serves hits at once. Many threads and
+ * processes can use the same files; the replies that are being written, or
+ * were partly written because of a crash, are detected with checksums and
+ * ignored. Nothing is evicted: when the files are full the new replies are
+ * not kept. Returns NULL if the files cannot be created or are not valid.
+ */
+ocgeo_disk_cache_t* ocgeo_disk_cache_open(const char* path, size_t max_bytes);
+void ocgeo_disk_cache_close(ocgeo_disk_cache_t* dc);
+
+/* Get the number of hits and misses (of this process), and the number and
+   size of the replies in the files */
+void ocgeo_disk_cache_get_stats(ocgeo_disk_cache_t* dc, ocgeo_cache_stats_t* stats);
+
+/* Rewrite the files of the disk cache at `path`, keeping only the valid
+   replies that are in its index, i.e. dropping the older ones for the same
+   requests and the torn ones. The new files have room for `max_bytes` of
+   replies (the same as before if 0), and replace the old ones; if that is
+   interrupted (e.g. by a crash) it's completed by the next open. The
+   processes that have the cache open keep serving hits from the old files but
+   add no more replies, until they open it again, so it's best run when none
+   has. Returns false if the cache does not exist, its replies don't fit in
+   `max_bytes`, or on error, and then the files are not changed. See also the
+   `compact_cache` program. */
+bool ocgeo_disk_cache_compact(const char* path, size_t max_bytes);
+
 /*
  * "Advanced" JSON traversing API!
  * This is useful for accessing the fields of the returned JSON document
@@ -288,6 +719,48 @@ int ocgeo_response_get_int(ocgeo_result_t* r, const char* path, bool* ok);
   `ok` will set to true */
 double ocgeo_response_get_dbl(ocgeo_result_t* r, const char* path, bool* ok);
 
+/*
+ * A path can also be "compiled" once and then used for any number of lookups,
+ * which are faster and allocate no memory. A compiled path is immutable so it
+ * can be shared by many threads.
+ */
+typedef struct ocgeo_path ocgeo_path_t;
+
+/* Compile the path, returns NULL on failure. The path should be freed with
+   `ocgeo_path_free` when no longer needed. */
+ocgeo_path_t* ocgeo_path_compile(const char* path);
+void ocgeo_path_free(ocgeo_path_t* path);
+
+/* Same as `ocgeo_response_get_str`, `ocgeo_response_get_int` and
+   `ocgeo_response_get_dbl` but with a compiled path */
+const char* ocgeo_path_get_str(ocgeo_result_t* r, const ocgeo_path_t* path, bool* ok);
+int ocgeo_path_get_int(ocgeo_result_t* r, const ocgeo_path_t* path, bool* ok);
+double ocgeo_path_get_dbl(ocgeo_result_t* r, const ocgeo_path_t* path, bool* ok);
+
+/*
+ * Getting many fields at once: the values of `count` compiled paths are put
+ * in the `values` array, walking the JSON tree only once for the segments that
+ * a path has in common with the previous one. So paths with common prefixes
+ * (e.g. "annotations.sun.rise.apparent", "annotations.sun.set.apparent") should
+ * be next to each other, e.g. sorted.
+ */
+#define OCGEO_VALUE_MISSING (0)	/* The field does not exist, or is 'null' */
+#define OCGEO_VALUE_STRING (1)
+#define OCGEO_VALUE_NUMBER (2)
+#define OCGEO_VALUE_BOOL (3)	/* Only `integer` is set, to 0 or 1 */
+#define OCGEO_VALUE_OTHER (4)	/* An object or an array */
+
+typedef struct ocgeo_value {
+	int type;           /* One of the OCGEO_VALUE_* */
+	const char* str;    /* For strings, points to internally managed memory */
+	int integer;        /* For numbers and bools */
+	double dbl;         /* For numbers */
+} ocgeo_value_t;
+
+/* Returns the number of fields found, i.e. not OCGEO_VALUE_MISSING */
+int ocgeo_path_get_values(ocgeo_result_t* r, const ocgeo_path_t* const paths[], int count,
+                          ocgeo_value_t values[]);
+
 /*
  * Some utils:
  */
@@ -348,6 +821,15 @@ double ocgeo_degrees_to_decimal_coords(ocgeo_dms_t d)
 	return d.degrees + sign * d.minutes / 60.0 + sign * d.seconds / 3600.0;
 }
 
+/*
+ * All the connections made by the library, in any thread, share a DNS cache
+ * and the TLS sessions. This releases these shared resources
+ * (and the interned strings, see `ocgeo_intern`) and should be called
+ * (optionally) at the end of the program, when there are no more clients or
+ * batches alive. No requests should be made afterwards.
+ */
+void ocgeo_global_cleanup(void);
+
 extern char* ocgeo_version;
 
 #ifdef __cplusplus
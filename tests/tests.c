@@ -1,8 +1,17 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <math.h>
 #include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include "ocgeo.h"
+#include "cJSON.h"
 
 #if _WIN32
 #  define C_RED(s)     s
@@ -47,6 +56,841 @@ d_eq_scale(double a, double b, int p)
 static int count_pass = 0;
 static int count_fail = 0;
 
+static void
+count_forbidden(bool ok, ocgeo_response_t* response, void* data)
+{
+    int* count = data;
+    if (ok && response->status.code == OCGEO_CODE_FORBIDDEN)
+        (*count)++;
+    ocgeo_response_cleanup(response);
+}
+
+/* Count the bodies (and their bytes) passed to the body callback */
+static void
+count_body(const char* body, size_t length, void* data)
+{
+    size_t* counts = data;
+    if (body[0] == '{' && body[length] == '\0' && strlen(body) == length) {
+        counts[0]++;
+        counts[1] += length;
+    }
+}
+
+static void
+count_pretty_json(const char* json, void* data)
+{
+    size_t* counts = data;
+    if (json[0] == '{' && strstr(json, "\n\t\"results\":\t[") != NULL)
+        counts[2]++;
+}
+
+/*
+ * Most paths of the library are tested against the local stand-in server of
+ * the benchmarks (bench/standin_server.py), without the network or an API key.
+ * It replies to every request with the same reply, with a single result.
+ */
+#define STANDIN_PORT 18089
+#define STANDIN_KEY "standin"
+
+static pid_t standin_pid = -1;
+
+static double
+now_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The URL of the API endpoint of the stand-in server, with an optional
+   `prefix` for its path (that makes it misbehave, see the server) */
+static const char*
+standin_url(const char* prefix)
+{
+    static char url[128];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d%s/geocode/v1/json", STANDIN_PORT, prefix);
+    return url;
+}
+
+static bool
+standin_listening(void)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return false;
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(STANDIN_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bool ok = connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0;
+    close(fd);
+    return ok;
+}
+
+/* Start the stand-in server (it needs python3) and wait until it accepts
+   connections. Returns false if it could not be started. */
+static bool
+start_standin_server(void)
+{
+    char port[16];
+    snprintf(port, sizeof(port), "%d", STANDIN_PORT);
+    /* Don't mistake another server (e.g. left from a crashed run) for ours: */
+    if (standin_listening())
+        return false;
+    standin_pid = fork();
+    if (standin_pid == 0) {
+        freopen("/dev/null", "w", stdout);
+        freopen("/dev/null", "w", stderr);
+        execlp("python3", "python3", "bench/standin_server.py", "--port", port, (char*) NULL);
+        _exit(127);
+    }
+    for (int i = 0; standin_pid > 0 && i < 100; ++i) {
+        if (standin_listening())
+            return true;
+        if (waitpid(standin_pid, NULL, WNOHANG) == standin_pid)
+            break;
+        usleep(50000);
+    }
+    standin_pid = -1;
+    return false;
+}
+
+static void
+stop_standin_server(void)
+{
+    if (standin_pid > 0) {
+        kill(standin_pid, SIGTERM);
+        waitpid(standin_pid, NULL, 0);
+        standin_pid = -1;
+    }
+}
+
+static void
+count_ok(bool ok, ocgeo_response_t* response, void* data)
+{
+    int* count = data;
+    if (ok && response->status.code == OCGEO_CODE_OK && response->total_results == 1)
+        count[0]++;
+    count[1] += (int) response->transfer.connects;
+    ocgeo_response_cleanup(response);
+}
+
+static void
+test_client(void)
+{
+    ocgeo_params_t params = ocgeo_default_params();
+    params.api_server = standin_url("");
+    ocgeo_client_t* client = ocgeo_client_new(STANDIN_KEY, &params);
+    ocgeo_response_t first, second;
+    ocgeo_client_forward(client, "Philippistraße 7, Münster", NULL, &first);
+    ocgeo_client_reverse(client, 51.952659, 7.632473, NULL, &second);
+    TEST("Testing a client reusing its connection", ocgeo_response_ok(&first) &&
+        ocgeo_response_ok(&second) && second.total_results == 1 &&
+        strcmp(second.results[0].road, "Philippistraße") == 0 &&
+        first.transfer.connects == 1 && second.transfer.connects == 0);
+    ocgeo_response_cleanup(&first);
+    ocgeo_response_cleanup(&second);
+    ocgeo_client_free(client);
+}
+
+static void
+test_batch(void)
+{
+    ocgeo_params_t params = ocgeo_default_params();
+    params.api_server = standin_url("");
+    int counts[2] = {0}; /* successful requests, connections made */
+    ocgeo_batch_t* batch = ocgeo_batch_new(STANDIN_KEY, &params, 4);
+    for (int i = 0; i < 20; ++i)
+        ocgeo_batch_forward(batch, "Münster", NULL, count_ok, counts);
+    TEST("Testing batch of 20 requests, 4 in flight", ocgeo_batch_run(batch) &&
+        counts[0] == 20 && counts[1] <= 4);
+    ocgeo_batch_free(batch);
+}
+
+static void
+test_rate_limiter(void)
+{
+    ocgeo_params_t params = ocgeo_default_params();
+    params.api_server = standin_url("");
+    params.rate_limiter = ocgeo_rate_limiter_new(20, 1);
+    ocgeo_client_t* client = ocgeo_client_new(STANDIN_KEY, &params);
+    ocgeo_response_t response;
+    int ok = 0;
+    double start = now_secs();
+    for (int i = 0; i < 6; ++i) {
+        ok += ocgeo_client_forward(client, "Münster", NULL, &response) && ocgeo_response_ok(&response);
+        ocgeo_response_cleanup(&response);
+    }
+    TEST("Testing rate limiter pacing 6 requests at 20/sec", ok == 6 && now_secs() - start >= 0.24);
+
+    /* A reply saying the quota is exhausted stops the next requests: */
+    params.api_server = standin_url("/quota/0");
+    ocgeo_client_forward(client, "Münster", &params, &response);
+    TEST("Testing rate limiter reading the quota", ocgeo_response_ok(&response) &&
+        response.rateInfo.remaining == 0);
+    ocgeo_response_cleanup(&response);
+    params.api_server = standin_url("");
+    ocgeo_client_forward(client, "Münster", &params, &response);
+    TEST("Testing client stopping at the exhausted quota", response.status.code == OCGEO_CODE_RATE_LIMITED &&
+        response.transfer.connects == 0);
+    ocgeo_response_cleanup(&response);
+
+    ocgeo_client_free(client);
+    ocgeo_rate_limiter_free(params.rate_limiter);
+}
+
+static void
+test_retries(void)
+{
+    ocgeo_params_t params = ocgeo_default_params();
+    ocgeo_client_t* client = ocgeo_client_new(STANDIN_KEY, &params);
+    ocgeo_response_t response;
+
+    params.api_server = standin_url("/flaky/2");
+    ocgeo_client_forward(client, "Münster", &params, &response);
+    TEST("Testing 503 without retries", !ocgeo_response_ok(&response) &&
+        response.status.code == OCGEO_CODE_INTERNAL_ERROR);
+    ocgeo_response_cleanup(&response);
+    params.retry.max_attempts = 3;
+    params.retry.base_delay_ms = 10;
+    ocgeo_client_forward(client, "Münster", &params, &response);
+    TEST("Testing retry of 503", ocgeo_response_ok(&response) && response.total_results == 1);
+    ocgeo_response_cleanup(&response);
+
+    /* All the attempts fail, the next request of the same URL succeeds: */
+    params.api_server = standin_url("/flaky/3");
+    ocgeo_client_forward(client, "Münster", &params, &response);
+    bool failed = response.status.code == OCGEO_CODE_INTERNAL_ERROR;
+    ocgeo_response_cleanup(&response);
+    ocgeo_client_forward(client, "Münster", &params, &response);
+    TEST("Testing retries stopping after max attempts", failed && ocgeo_response_ok(&response));
+    ocgeo_response_cleanup(&response);
+
+    params.api_server = standin_url("/status/403");
+    ocgeo_client_forward(client, "Münster", &params, &response);
+    TEST("Testing no retries of 403", response.status.code == OCGEO_CODE_FORBIDDEN);
+    ocgeo_response_cleanup(&response);
+
+    params.api_server = standin_url("/flaky/100");
+    params.retry.max_attempts = 100;
+    params.retry.base_delay_ms = 100;
+    params.retry.deadline_ms = 200;
+    double start = now_secs();
+    ocgeo_client_forward(client, "Münster", &params, &response);
+    TEST("Testing retries within the deadline", response.status.code == OCGEO_CODE_INTERNAL_ERROR &&
+        now_secs() - start < 0.5);
+    ocgeo_response_cleanup(&response);
+
+    /* The retried attempt gets only what remains of the deadline: */
+    params.api_server = standin_url("/flaky/1/delay/150");
+    params.retry.max_attempts = 2;
+    params.retry.base_delay_ms = 10;
+    params.retry.deadline_ms = 250;
+    start = now_secs();
+    ocgeo_client_forward(client, "Münster", &params, &response);
+    TEST("Testing retried attempt within the deadline",
+        response.status.code == OCGEO_CODE_DEADLINE_EXCEEDED && now_secs() - start < 0.3);
+    ocgeo_response_cleanup(&response);
+
+    /* An exhausted quota is retried after its reset, if there's no cap: */
+    params.api_server = standin_url("/flaky/1:429/quota/0/reset/2");
+    params.retry.deadline_ms = 0;
+    start = now_secs();
+    ocgeo_client_forward(client, "Münster", &params, &response);
+    TEST("Testing retry of 429 after the quota's reset", ocgeo_response_ok(&response) &&
+        now_secs() - start >= 1);
+    ocgeo_response_cleanup(&response);
+    params.api_server = standin_url("/flaky/1:429/quota/0/reset/60");
+    params.retry.deadline_ms = 500;
+    start = now_secs();
+    ocgeo_client_forward(client, "Münster", &params, &response);
+    TEST("Testing no retry of 429 after the deadline",
+        response.status.code == OCGEO_CODE_MANY_REQUESTS && now_secs() - start < 0.5);
+    ocgeo_response_cleanup(&response);
+
+    ocgeo_client_free(client);
+}
+
+static void
+count_deadline_exceeded(bool ok, ocgeo_response_t* response, void* data)
+{
+    int* count = data;
+    if (!ok && response->status.code == OCGEO_CODE_DEADLINE_EXCEEDED)
+        (*count)++;
+    ocgeo_response_cleanup(response);
+}
+
+static void
+test_timeouts(void)
+{
+    ocgeo_params_t params = ocgeo_default_params();
+    params.api_server = standin_url("/delay/3000");
+    params.timeout_ms = 200;
+    ocgeo_client_t* client = ocgeo_client_new(STANDIN_KEY, &params);
+    ocgeo_response_t response;
+    double start = now_secs();
+    bool ok = ocgeo_client_forward(client, "Münster", NULL, &response);
+    TEST("Testing request timeout", !ok && response.status.code == OCGEO_CODE_DEADLINE_EXCEEDED &&
+        response.error.stage == OCGEO_ERROR_TRANSPORT && now_secs() - start < 1);
+    ocgeo_response_cleanup(&response);
+
+    params.timeout_ms = 0;
+    params.low_speed_limit = 1;
+    params.low_speed_time = 1;
+    start = now_secs();
+    ok = ocgeo_client_forward(client, "Münster", &params, &response);
+    TEST("Testing low speed limit", !ok && response.status.code == OCGEO_CODE_DEADLINE_EXCEEDED &&
+        now_secs() - start < 2.5);
+    ocgeo_response_cleanup(&response);
+    ocgeo_client_free(client);
+
+    params.low_speed_limit = params.low_speed_time = 0;
+    params.timeout_ms = 200;
+    int count = 0;
+    ocgeo_batch_t* batch = ocgeo_batch_new(STANDIN_KEY, &params, 4);
+    for (int i = 0; i < 4; ++i)
+        ocgeo_batch_forward(batch, "Münster", NULL, count_deadline_exceeded, &count);
+    start = now_secs();
+    ocgeo_batch_run(batch);
+    TEST("Testing request timeouts in a batch", count == 4 && now_secs() - start < 1);
+    ocgeo_batch_free(batch);
+}
+
+static void
+test_hedging(void)
+{
+    ocgeo_params_t params = ocgeo_default_params();
+    params.api_server = standin_url("");
+    ocgeo_client_t* client = ocgeo_client_new(STANDIN_KEY, &params);
+    ocgeo_response_t response;
+    bool ok = ocgeo_client_enable_hedging(client, 50, 1.0);
+    /* Enough requests for estimating the latency: */
+    for (int i = 0; i < 20; ++i) {
+        ok = ocgeo_client_forward(client, "Münster", NULL, &response) && ok;
+        ocgeo_response_cleanup(&response);
+    }
+    /* The first request of this URL is slow, the hedged one is not: */
+    params.api_server = standin_url("/slowfirst/2000");
+    double start = now_secs();
+    ok = ocgeo_client_forward(client, "Münster", &params, &response) && ok;
+    TEST("Testing hedged request", ok && ocgeo_response_ok(&response) && now_secs() - start < 1);
+    ocgeo_response_cleanup(&response);
+
+    ocgeo_client_disable_hedging(client);
+    params.api_server = standin_url("/slowfirst/300");
+    start = now_secs();
+    ok = ocgeo_client_forward(client, "Münster", &params, &response);
+    TEST("Testing disabled hedging", ok && now_secs() - start >= 0.3);
+    ocgeo_response_cleanup(&response);
+    ocgeo_client_free(client);
+}
+
+static void
+test_compression(void)
+{
+    ocgeo_params_t params = ocgeo_default_params();
+    params.api_server = standin_url("");
+    ocgeo_client_t* client = ocgeo_client_new(STANDIN_KEY, &params);
+    ocgeo_response_t compressed, plain;
+    ocgeo_client_forward(client, "Münster", NULL, &compressed);
+    params.no_compression = true;
+    ocgeo_client_forward(client, "Münster", &params, &plain);
+    TEST("Testing compressed reply", ocgeo_response_ok(&compressed) && ocgeo_response_ok(&plain) &&
+        compressed.total_results == 1 && plain.total_results == 1 &&
+        strcmp(compressed.results[0].formatted, plain.results[0].formatted) == 0 &&
+        compressed.transfer.bytes > 0 && compressed.transfer.bytes < plain.transfer.bytes / 2);
+    ocgeo_response_cleanup(&compressed);
+    ocgeo_response_cleanup(&plain);
+
+    params.no_compression = false;
+    params.api_server = standin_url("/status/403");
+    ocgeo_client_forward(client, "Münster", &params, &compressed);
+    TEST("Testing compressed error reply", compressed.status.code == OCGEO_CODE_FORBIDDEN &&
+        compressed.error.stage == OCGEO_ERROR_NONE);
+    ocgeo_response_cleanup(&compressed);
+    ocgeo_client_free(client);
+}
+
+static bool
+same_str(const char* a, const char* b)
+{
+    return a == NULL ? b == NULL : b != NULL && strcmp(a, b) == 0;
+}
+
+/* Whether two results have the same fields and the same JSON */
+static bool
+same_result(ocgeo_result_t* a, ocgeo_result_t* b)
+{
+    char* json_a = cJSON_PrintUnformatted(a->internal);
+    char* json_b = cJSON_PrintUnformatted(b->internal);
+    bool same = json_a != NULL && same_str(json_a, json_b) &&
+        same_str(a->formatted, b->formatted) && same_str(a->road, b->road) &&
+        same_str(a->country_code, b->country_code) && a->geometry.lat == b->geometry.lat &&
+        a->geometry.lng == b->geometry.lng && a->confidence == b->confidence &&
+        a->callingcode == b->callingcode && (a->bounds == NULL) == (b->bounds == NULL) &&
+        (a->timezone == NULL ? b->timezone == NULL : b->timezone != NULL &&
+            same_str(a->timezone->name, b->timezone->name)) &&
+        (a->currency == NULL ? b->currency == NULL : b->currency != NULL &&
+            same_str(a->currency->iso_code, b->currency->iso_code));
+    cJSON_free(json_a);
+    cJSON_free(json_b);
+    return same;
+}
+
+/* Whether the results of a streamed response are the same as the buffered
+   ones, and are linked in the JSON tree as parsed in one go */
+static bool
+same_results(ocgeo_response_t* streamed, ocgeo_response_t* buffered)
+{
+    if (streamed->total_results != buffered->total_results || streamed->total_results == 0)
+        return false;
+    cJSON* item = streamed->results[0].internal;
+    for (int k = 0; k < streamed->total_results; ++k, item = item->next) {
+        if (item != streamed->results[k].internal ||
+            !same_result(streamed->results + k, buffered->results + k))
+            return false;
+    }
+    cJSON* first = streamed->results[0].internal;
+    return item == NULL && first->prev == streamed->results[streamed->total_results - 1].internal;
+}
+
+static void
+test_streaming_parse(void)
+{
+    ocgeo_params_t params = ocgeo_default_params();
+    ocgeo_client_t* client = ocgeo_client_new(STANDIN_KEY, &params);
+    ocgeo_response_t buffered, streamed;
+
+    /* Small pieces, so that the results are split across many writes: */
+    params.api_server = standin_url("/results/5/chunks/256");
+    for (int compressed = 0; compressed < 2; ++compressed) {
+        params.no_compression = !compressed;
+        params.streaming_parse = false;
+        ocgeo_client_forward(client, "Münster", &params, &buffered);
+        params.streaming_parse = true;
+        ocgeo_client_forward(client, "Münster", &params, &streamed);
+        TEST(compressed ? "Testing streaming parse of a compressed reply in pieces" :
+            "Testing streaming parse of a reply in pieces",
+            ocgeo_response_ok(&buffered) && ocgeo_response_ok(&streamed) &&
+            buffered.total_results == 5 && same_results(&streamed, &buffered));
+        ocgeo_response_cleanup(&buffered);
+        ocgeo_response_cleanup(&streamed);
+    }
+
+    /* Invalid JSON before, in, and after the results: */
+    params.no_compression = true;
+    params.streaming_parse = false;
+    params.api_server = standin_url("/results/5");
+    ocgeo_client_forward(client, "Münster", &params, &buffered);
+    long length = buffered.transfer.bytes;
+    ocgeo_response_cleanup(&buffered);
+    long offsets[] = {20, length / 2, length - 40};
+    int same_errors = 0;
+    for (int i = 0; i < 3; ++i) {
+        char prefix[64];
+        snprintf(prefix, sizeof(prefix), "/results/5/chunks/256/corrupt/%ld", offsets[i]);
+        params.api_server = standin_url(prefix);
+        params.streaming_parse = false;
+        ocgeo_client_forward(client, "Münster", &params, &buffered);
+        params.streaming_parse = true;
+        ocgeo_client_forward(client, "Münster", &params, &streamed);
+        if (buffered.error.stage == OCGEO_ERROR_PARSE && streamed.error.stage == OCGEO_ERROR_PARSE &&
+            buffered.error.offset >= offsets[i] && streamed.error.offset == buffered.error.offset)
+            same_errors++;
+        ocgeo_response_cleanup(&buffered);
+        ocgeo_response_cleanup(&streamed);
+    }
+    TEST("Testing streaming parse errors", same_errors == 3);
+    ocgeo_client_free(client);
+}
+
+/* Make a request with the cache of the `params`, and check that it was a
+   hit or not, and the stats of the cache afterwards */
+static bool
+cached_request(ocgeo_client_t* client, ocgeo_params_t* params, const char* query, bool hit,
+               unsigned long hits, unsigned long misses, unsigned long evictions, size_t entries)
+{
+    ocgeo_response_t response;
+    ocgeo_cache_stats_t stats;
+    bool ok = ocgeo_client_forward(client, query, params, &response) && ocgeo_response_ok(&response) &&
+        response.total_results == 1 && response.transfer.from_cache == hit;
+    ocgeo_response_cleanup(&response);
+    ocgeo_cache_get_stats(params->cache, &stats);
+    return ok && stats.hits == hits && stats.misses == misses && stats.evictions == evictions &&
+        stats.entries == entries;
+}
+
+static void
+test_cache(void)
+{
+    ocgeo_params_t params = ocgeo_default_params();
+    params.api_server = standin_url("");
+    ocgeo_client_t* client = ocgeo_client_new(STANDIN_KEY, &params);
+    ocgeo_cache_stats_t stats;
+
+    /* The size of an entry, the queries are of the same length: */
+    params.cache = ocgeo_cache_new(1 << 20, 1);
+    bool ok = cached_request(client, &params, "Place A", false, 0, 1, 0, 1);
+    ocgeo_cache_get_stats(params.cache, &stats);
+    size_t entry_size = stats.bytes;
+    ocgeo_cache_free(params.cache);
+    TEST("Testing response cache miss", ok && entry_size > 0);
+
+    /* Room for two entries: */
+    params.cache = ocgeo_cache_new(entry_size * 5 / 2, 1);
+    ok = cached_request(client, &params, "Place A", false, 0, 1, 0, 1) &&
+        cached_request(client, &params, "Place A", true, 1, 1, 0, 1);
+    TEST("Testing response cache hit", ok);
+    ok = cached_request(client, &params, "Place B", false, 1, 2, 0, 2) &&
+        cached_request(client, &params, "Place A", true, 2, 2, 0, 2) &&
+        /* B is the least recently used: */
+        cached_request(client, &params, "Place C", false, 2, 3, 1, 2) &&
+        cached_request(client, &params, "Place A", true, 3, 3, 1, 2) &&
+        cached_request(client, &params, "Place B", false, 3, 4, 2, 2) &&
+        cached_request(client, &params, "Place A", true, 4, 4, 2, 2);
+    ocgeo_cache_get_stats(params.cache, &stats);
+    TEST("Testing response cache LRU eviction", ok && stats.bytes == 2 * entry_size);
+    ocgeo_cache_free(params.cache);
+
+    /* Two identical requests at once both miss, and the second reply
+       replaces the first: */
+    params.cache = ocgeo_cache_new(entry_size * 5 / 2, 1);
+    int counts[2] = {0};
+    ocgeo_batch_t* batch = ocgeo_batch_new(STANDIN_KEY, &params, 2);
+    ocgeo_batch_forward(batch, "Place A", NULL, count_ok, counts);
+    ocgeo_batch_forward(batch, "Place A", NULL, count_ok, counts);
+    ok = ocgeo_batch_run(batch) && counts[0] == 2;
+    ocgeo_batch_free(batch);
+    ocgeo_cache_get_stats(params.cache, &stats);
+    TEST("Testing response cache replacing a reply", ok && stats.misses == 2 && stats.entries == 1 &&
+        stats.evictions == 0 && stats.bytes == entry_size &&
+        cached_request(client, &params, "Place A", true, 1, 2, 0, 1));
+    ocgeo_cache_free(params.cache);
+
+    /* A reply larger than the cache is not kept: */
+    params.cache = ocgeo_cache_new(entry_size / 2, 1);
+    ok = cached_request(client, &params, "Place A", false, 0, 1, 0, 0) &&
+        cached_request(client, &params, "Place A", false, 0, 2, 0, 0);
+    ocgeo_cache_get_stats(params.cache, &stats);
+    TEST("Testing response cache size limit", ok && stats.bytes == 0);
+    ocgeo_cache_free(params.cache);
+
+    /* Four shards with room for two entries each, all filled: */
+    params.cache = ocgeo_cache_new(4 * entry_size * 5 / 2, 4);
+    ok = true;
+    for (int i = 0; i < 40; ++i) {
+        char query[16];
+        snprintf(query, sizeof(query), "Place %c", "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmn"[i]);
+        ocgeo_response_t response;
+        ok = ocgeo_client_forward(client, query, &params, &response) && ok;
+        ocgeo_response_cleanup(&response);
+    }
+    ocgeo_cache_get_stats(params.cache, &stats);
+    TEST("Testing sharded response cache", ok && stats.misses == 40 && stats.entries == 8 &&
+        stats.evictions == 32 && stats.bytes == 8 * entry_size);
+    ocgeo_cache_free(params.cache);
+
+    /* A reply of 100 KB is not kept if the shards get less, but by default a
+       1 MB cache is not split in parts that small: */
+    params.api_server = standin_url("/results/30");
+    params.cache = ocgeo_cache_new(1 << 20, 16);
+    ocgeo_response_t response;
+    ocgeo_client_forward(client, "Place A", &params, &response);
+    ocgeo_cache_get_stats(params.cache, &stats);
+    ok = response.total_results == 30 && response.transfer.bytes > 0 && stats.entries == 0;
+    ocgeo_response_cleanup(&response);
+    ocgeo_cache_free(params.cache);
+    params.cache = ocgeo_cache_new(1 << 20, 0);
+    ocgeo_client_forward(client, "Place A", &params, &response);
+    ocgeo_cache_get_stats(params.cache, &stats);
+    TEST("Testing response cache shards for large replies", ok && response.total_results == 30 &&
+        stats.entries == 1 && stats.bytes > 64 * 1024);
+    ocgeo_response_cleanup(&response);
+    ocgeo_cache_free(params.cache);
+    ocgeo_client_free(client);
+}
+
+#define DISK_PATH "ocgeo_tests_disk"
+
+static void
+remove_disk_cache(const char* path)
+{
+    const char* suffixes[] = {".idx", ".log", ".idx.tmp", ".log.tmp"};
+    char name[128];
+    for (int i = 0; i < 4; ++i) {
+        snprintf(name, sizeof(name), "%s%s", path, suffixes[i]);
+        remove(name);
+    }
+}
+
+/* Request the `query` with the disk cache of the `params`, returns 1 for a
+   hit, 0 for a miss, or -1 if the request failed */
+static int
+disk_cached_request(ocgeo_client_t* client, ocgeo_params_t* params, const char* query)
+{
+    ocgeo_response_t response;
+    bool ok = ocgeo_client_forward(client, query, params, &response) && ocgeo_response_ok(&response);
+    int result = ok ? response.transfer.from_cache : -1;
+    ocgeo_response_cleanup(&response);
+    return result;
+}
+
+/* The offset of the first `str` in the file, or -1 */
+static long
+find_in_file(const char* path, const char* str)
+{
+    FILE* f = fopen(path, "rb");
+    if (f == NULL)
+        return -1;
+    size_t len = strlen(str), matched = 0;
+    long offset = 0;
+    for (int c; (c = fgetc(f)) != EOF && matched < len; ++offset)
+        matched = c == str[matched] ? matched + 1 : (c == str[0] ? 1 : 0);
+    fclose(f);
+    return matched == len ? offset - (long) len : -1;
+}
+
+/* Overwrite `count` bytes of the file at `offset` with `byte` */
+static bool
+patch_file(const char* path, long offset, int byte, int count)
+{
+    FILE* f = fopen(path, "r+b");
+    if (f == NULL || offset < 0 || fseek(f, offset, SEEK_SET) != 0) {
+        if (f)
+            fclose(f);
+        return false;
+    }
+    for (int i = 0; i < count; ++i)
+        fputc(byte, f);
+    return fclose(f) == 0;
+}
+
+static void
+test_disk_cache(void)
+{
+    ocgeo_params_t params = ocgeo_default_params();
+    params.api_server = standin_url("");
+    ocgeo_client_t* client = ocgeo_client_new(STANDIN_KEY, &params);
+    ocgeo_cache_stats_t stats;
+
+    remove_disk_cache(DISK_PATH);
+    params.disk_cache = ocgeo_disk_cache_open(DISK_PATH, 256 * 1024);
+    bool ok = params.disk_cache != NULL && disk_cached_request(client, &params, "PlaceA") == 0 &&
+        disk_cached_request(client, &params, "PlaceA") == 1 &&
+        disk_cached_request(client, &params, "PlaceB") == 0 &&
+        disk_cached_request(client, &params, "PlaceC") == 0;
+    ocgeo_disk_cache_get_stats(params.disk_cache, &stats);
+    TEST("Testing disk cache", ok && stats.hits == 1 && stats.misses == 3 && stats.entries == 3);
+    ocgeo_disk_cache_close(params.disk_cache);
+
+    /* Another process (as after a restart) serves the hits at once: */
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        ocgeo_client_t* child = ocgeo_client_new(STANDIN_KEY, &params);
+        params.disk_cache = ocgeo_disk_cache_open(DISK_PATH, 0);
+        bool hit = params.disk_cache != NULL && disk_cached_request(child, &params, "PlaceA") == 1 &&
+            disk_cached_request(child, &params, "PlaceC") == 1;
+        _exit(hit ? 0 : 1);
+    }
+    int status = 1;
+    waitpid(pid, &status, 0);
+    TEST("Testing disk cache in another process", WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    /* A corrupted record, and a torn one (as if the process crashed while
+       writing it), are misses: */
+    ok = patch_file(DISK_PATH ".log", find_in_file(DISK_PATH ".log", "q=PlaceB") + 200, '#', 1) &&
+        patch_file(DISK_PATH ".log", find_in_file(DISK_PATH ".log", "q=PlaceC") + 500, 0, 1000);
+    params.disk_cache = ocgeo_disk_cache_open(DISK_PATH, 0);
+    ok = ok && params.disk_cache != NULL && disk_cached_request(client, &params, "PlaceA") == 1 &&
+        disk_cached_request(client, &params, "PlaceB") == 0 &&
+        disk_cached_request(client, &params, "PlaceC") == 0 &&
+        disk_cached_request(client, &params, "PlaceB") == 1 &&
+        disk_cached_request(client, &params, "PlaceC") == 1;
+    ocgeo_cache_stats_t before;
+    ocgeo_disk_cache_get_stats(params.disk_cache, &before);
+    TEST("Testing disk cache with corrupted and torn records", ok && before.entries == 3);
+
+    /* Compacting, while a process has the old files open: */
+    ok = ocgeo_disk_cache_compact(DISK_PATH, 0) && disk_cached_request(client, &params, "PlaceA") == 1 &&
+        disk_cached_request(client, &params, "PlaceD") == 0;
+    ocgeo_disk_cache_close(params.disk_cache);
+    params.disk_cache = ocgeo_disk_cache_open(DISK_PATH, 0);
+    ocgeo_disk_cache_get_stats(params.disk_cache, &stats);
+    TEST("Testing compacting the disk cache", ok && params.disk_cache != NULL &&
+        stats.entries == 3 && stats.bytes < before.bytes &&
+        disk_cached_request(client, &params, "PlaceA") == 1 &&
+        disk_cached_request(client, &params, "PlaceB") == 1 &&
+        disk_cached_request(client, &params, "PlaceC") == 1 &&
+        /* The old files were retired, so it was not added to them: */
+        disk_cached_request(client, &params, "PlaceD") == 0);
+    ocgeo_disk_cache_close(params.disk_cache);
+
+    /* With the program, to a larger size: */
+    fflush(stdout);
+    ok = system("./compact_cache " DISK_PATH " 1 > /dev/null") == 0;
+    params.disk_cache = ocgeo_disk_cache_open(DISK_PATH, 0);
+    ok = ok && params.disk_cache != NULL && disk_cached_request(client, &params, "PlaceD") == 1;
+    ocgeo_disk_cache_get_stats(params.disk_cache, &stats);
+    TEST("Testing compact_cache", ok && stats.entries == 4 && stats.bytes < before.bytes);
+    ocgeo_disk_cache_close(params.disk_cache);
+
+    /* A truncated log is not valid: */
+    FILE* f = fopen(DISK_PATH ".log", "r+b");
+    ok = f != NULL && ftruncate(fileno(f), 4096) == 0;
+    if (f)
+        fclose(f);
+    TEST("Testing truncated disk cache", ok && ocgeo_disk_cache_open(DISK_PATH, 0) == NULL);
+    remove_disk_cache(DISK_PATH);
+
+    /* When full, the new replies are not kept, the old ones are: */
+    params.disk_cache = ocgeo_disk_cache_open(DISK_PATH, 64 * 1024);
+    int misses = 0;
+    for (int i = 0; i < 30; ++i) {
+        char query[16];
+        snprintf(query, sizeof(query), "Place%02d", i);
+        misses += disk_cached_request(client, &params, query) == 0;
+    }
+    ocgeo_disk_cache_get_stats(params.disk_cache, &stats);
+    TEST("Testing full disk cache", misses == 30 && stats.entries > 0 && stats.entries < 30 &&
+        stats.bytes <= 64 * 1024 && disk_cached_request(client, &params, "Place00") == 1 &&
+        disk_cached_request(client, &params, "Place29") == 0);
+    ocgeo_disk_cache_close(params.disk_cache);
+    remove_disk_cache(DISK_PATH);
+    ocgeo_client_free(client);
+}
+
+static void
+test_body_callback(void)
+{
+    ocgeo_params_t params = ocgeo_default_params();
+    params.api_server = standin_url("");
+    size_t counts[3] = {0}; /* bodies, their bytes, and the debug callbacks */
+    params.callback_data = counts;
+    params.body_callback = count_body;
+    params.dbg_callback = count_pretty_json;
+    ocgeo_client_t* client = ocgeo_client_new(STANDIN_KEY, &params);
+    ocgeo_response_t response;
+    ocgeo_client_forward(client, "Münster", NULL, &response);
+    ocgeo_response_cleanup(&response);
+    params.no_compression = true;
+    ocgeo_client_forward(client, "Münster", &params, &response);
+    TEST("Testing body callback", ocgeo_response_ok(&response) && counts[0] == 2 &&
+        counts[1] == 2 * (size_t) response.transfer.bytes && counts[2] == 2);
+    ocgeo_response_cleanup(&response);
+
+    /* Sampling 1 in 4 replies, expect 50 of 200 (the standard deviation is
+       about 6) with the client and with a batch: */
+    params.dbg_callback = NULL;
+    params.body_sample_rate = 4;
+    counts[0] = 0;
+    for (int i = 0; i < 200; ++i) {
+        ocgeo_client_forward(client, "Münster", &params, &response);
+        ocgeo_response_cleanup(&response);
+    }
+    TEST("Testing sampled body callback", counts[0] >= 25 && counts[0] <= 75);
+    counts[0] = 0;
+    int ok[2] = {0};
+    ocgeo_batch_t* batch = ocgeo_batch_new(STANDIN_KEY, &params, 4);
+    for (int i = 0; i < 200; ++i)
+        ocgeo_batch_forward(batch, "Münster", NULL, count_ok, ok);
+    TEST("Testing sampled body callback in a batch", ocgeo_batch_run(batch) && ok[0] == 200 &&
+        counts[0] >= 25 && counts[0] <= 75);
+    ocgeo_batch_free(batch);
+    ocgeo_client_free(client);
+}
+
+/* Whether only the geometry and country code of the result are filled in */
+static bool
+only_geometry_and_country_code(ocgeo_result_t* r, ocgeo_result_t* full)
+{
+    return same_str(r->country_code, full->country_code) && r->country_code != NULL &&
+        r->geometry.lat == full->geometry.lat && r->geometry.lng == full->geometry.lng &&
+        r->formatted == NULL && r->bounds == NULL && r->confidence == 0 && r->ISO_alpha2 == NULL &&
+        r->type == NULL && r->country == NULL && r->road == NULL && r->postcode == NULL &&
+        r->callingcode == 0 && r->timezone == NULL && r->roadinfo == NULL && r->currency == NULL &&
+        r->geohash == NULL && r->what3words == NULL;
+}
+
+static void
+test_field_projection(void)
+{
+    ocgeo_params_t params = ocgeo_default_params();
+    params.api_server = standin_url("/results/3");
+    ocgeo_client_t* client = ocgeo_client_new(STANDIN_KEY, &params);
+    ocgeo_response_t full, projected;
+    ocgeo_client_forward(client, "Münster", NULL, &full);
+    bool ok = ocgeo_response_ok(&full) && full.total_results == 3 &&
+        strstr(full.url, "no_annotations=0") != NULL && full.results[2].formatted != NULL &&
+        full.results[2].timezone != NULL && full.results[2].currency != NULL;
+
+    /* The stand-in sends the annotations anyway, they are not parsed: */
+    params.fields = OCGEO_FIELD_GEOMETRY | OCGEO_FIELD_COUNTRY_CODE;
+    for (int streaming = 0; streaming < 2; ++streaming) {
+        params.streaming_parse = streaming;
+        ocgeo_client_forward(client, "Münster", &params, &projected);
+        bool same = ok && ocgeo_response_ok(&projected) && projected.total_results == 3 &&
+            strstr(projected.url, "no_annotations=1") != NULL;
+        for (int i = 0; same && i < 3; ++i)
+            same = only_geometry_and_country_code(projected.results + i, full.results + i);
+        TEST(streaming ? "Testing field projection, streaming" : "Testing field projection", same);
+        ocgeo_response_cleanup(&projected);
+    }
+
+    /* With an annotation they are requested: */
+    params.streaming_parse = false;
+    params.fields = OCGEO_FIELD_FORMATTED | OCGEO_FIELD_TIMEZONE;
+    ocgeo_client_forward(client, "Münster", &params, &projected);
+    TEST("Testing field projection with an annotation", ok && ocgeo_response_ok(&projected) &&
+        strstr(projected.url, "no_annotations=0") != NULL &&
+        same_str(projected.results[0].formatted, full.results[0].formatted) &&
+        projected.results[0].timezone != NULL &&
+        same_str(projected.results[0].timezone->name, full.results[0].timezone->name) &&
+        projected.results[0].currency == NULL && projected.results[0].country_code == NULL &&
+        !ocgeo_is_valid_latlng(projected.results[0].geometry));
+    ocgeo_response_cleanup(&projected);
+    ocgeo_response_cleanup(&full);
+    ocgeo_client_free(client);
+}
+
+static void
+min_http_version(bool ok, ocgeo_response_t* response, void* data)
+{
+    int* version = data;
+    if (!ok || response->status.code != OCGEO_CODE_OK)
+        *version = -1;
+    else if (*version == 0 || response->transfer.http_version < *version)
+        *version = response->transfer.http_version;
+    ocgeo_response_cleanup(response);
+}
+
+static void
+test_http2(void)
+{
+    ocgeo_params_t params = ocgeo_default_params();
+    params.api_server = standin_url("");
+
+    /* Without TLS HTTP/2 is only used if asked for explicitly: */
+    int version = 0;
+    ocgeo_batch_t* batch = ocgeo_batch_new(STANDIN_KEY, &params, 4);
+    ocgeo_batch_enable_http2(batch, 4, 1);
+    for (int i = 0; i < 4; ++i)
+        ocgeo_batch_forward(batch, "Münster", NULL, min_http_version, &version);
+    TEST("Testing batch with HTTP/2 enabled over plain HTTP", ocgeo_batch_run(batch) &&
+        version == 11);
+    ocgeo_batch_free(batch);
+
+    /* A single request, libcurl may not reuse h2c connections reliably: */
+    version = 0;
+    batch = ocgeo_batch_new(STANDIN_KEY, &params, 1);
+    if (ocgeo_batch_enable_http2(batch, 4, 1) && ocgeo_batch_enable_h2c(batch)) {
+        ocgeo_batch_forward(batch, "Münster", NULL, min_http_version, &version);
+        TEST("Testing batch with HTTP/2 with prior knowledge", ocgeo_batch_run(batch) &&
+            version == 20);
+    }
+    ocgeo_batch_free(batch);
+}
+
 int main(int argc, char* argv[])
 {
 
@@ -67,11 +911,32 @@ int main(int argc, char* argv[])
     TEST("Testing 429 response", response.status.code == OCGEO_CODE_MANY_REQUESTS);
     ocgeo_response_cleanup(&response);
 
+    ocgeo_client_t* client = ocgeo_client_new("2e10e5e828262eb243ec0b54681d699a", &params);
+    TEST("Testing client creation", client != NULL);
+    ocgeo_client_forward(client, query, NULL, &response);
+    TEST("Testing 403 response using a client", response.status.code == OCGEO_CODE_FORBIDDEN);
+    ocgeo_response_cleanup(&response);
+    ocgeo_client_reverse(client, 51.952659, 7.632473, NULL, &response);
+    TEST("Testing 403 response using a client again", response.status.code == OCGEO_CODE_FORBIDDEN);
+    ocgeo_response_cleanup(&response);
+    ocgeo_client_free(client);
+
+    int forbidden = 0;
+    ocgeo_batch_t* batch = ocgeo_batch_new("2e10e5e828262eb243ec0b54681d699a", &params, 2);
+    ocgeo_batch_forward(batch, query, NULL, count_forbidden, &forbidden);
+    ocgeo_batch_forward(batch, "Münster", NULL, count_forbidden, &forbidden);
+    ocgeo_batch_reverse(batch, 51.952659, 7.632473, NULL, count_forbidden, &forbidden);
+    TEST("Testing batch of 3 requests", ocgeo_batch_run(batch) && forbidden == 3);
+    ocgeo_batch_free(batch);
+
     params.no_annotations = false;
     ocgeo_forward(query, "6d0e711d72d74daeb2b0bfd2a5cdfdba", &params, &response);
     TEST("Testing 200 response", response.status.code == OCGEO_CODE_OK);
     TEST("Testing getting results", response.total_results > 0 && response.results != NULL);
     ocgeo_result_t* result = response.results;
+    ocgeo_result_t no_result = {0};
+    if (result == NULL) /* e.g. no network, the following tests should fail, not crash */
+        result = &no_result;
     TEST("Testing currency annotation", result->currency != NULL &&
         strcmp(result->currency->iso_code, "EUR")==0 &&
         strcmp(result->currency->name, "Euro")==0 &&
@@ -95,9 +960,155 @@ int main(int argc, char* argv[])
     TEST("Testing adv API, getting nonexistent string field", 
         ocgeo_response_get_str(result, "annotations.NON-EXISTENT", &ok) == NULL && !ok);
 
+    ocgeo_response_t streamed;
+    params.streaming_parse = true;
+    ocgeo_forward(query, "6d0e711d72d74daeb2b0bfd2a5cdfdba", &params, &streamed);
+    params.streaming_parse = false;
+    TEST("Testing streaming parse", streamed.status.code == OCGEO_CODE_OK &&
+        streamed.total_results == response.total_results && streamed.total_results > 0 &&
+        strcmp(streamed.results[0].formatted, result->formatted) == 0 &&
+        strcmp(ocgeo_response_get_str(&streamed.results[0], "annotations.DMS.lat", &ok), lat) == 0);
+    ocgeo_response_cleanup(&streamed);
+
+    ocgeo_cache_stats_t stats;
+    params.cache = ocgeo_cache_new(1 << 20, 0);
+    ocgeo_forward(query, "6d0e711d72d74daeb2b0bfd2a5cdfdba", &params, &streamed);
+    ocgeo_response_cleanup(&streamed);
+    ocgeo_forward(query, "6d0e711d72d74daeb2b0bfd2a5cdfdba", &params, &streamed);
+    ocgeo_cache_get_stats(params.cache, &stats);
+    TEST("Testing response cache", streamed.status.code == OCGEO_CODE_OK && streamed.transfer.from_cache &&
+        streamed.total_results == response.total_results && stats.hits == 1 && stats.entries == 1);
+    ocgeo_response_cleanup(&streamed);
+    ocgeo_cache_free(params.cache);
+    params.cache = NULL;
+
+    const char* disk_path = "ocgeo_tests_cache";
+    params.disk_cache = ocgeo_disk_cache_open(disk_path, 1 << 20);
+    ocgeo_forward(query, "6d0e711d72d74daeb2b0bfd2a5cdfdba", &params, &streamed);
+    ocgeo_response_cleanup(&streamed);
+    /* Reopened, as after a restart: */
+    ocgeo_disk_cache_close(params.disk_cache);
+    params.disk_cache = ocgeo_disk_cache_open(disk_path, 1 << 20);
+    ocgeo_forward(query, "6d0e711d72d74daeb2b0bfd2a5cdfdba", &params, &streamed);
+    ocgeo_disk_cache_close(params.disk_cache);
+    params.disk_cache = NULL;
+    TEST("Testing persistent response cache", streamed.status.code == OCGEO_CODE_OK &&
+        streamed.transfer.from_cache && streamed.total_results == response.total_results &&
+        ocgeo_disk_cache_compact(disk_path, 0));
+    ocgeo_response_cleanup(&streamed);
+    remove("ocgeo_tests_cache.idx");
+    remove("ocgeo_tests_cache.log");
+
     ocgeo_response_cleanup(&response);
 
 
+    const char* canned = "{\"status\": {\"code\": 200, \"message\": \"OK\"}, \"total_results\": 1,"
+        "\"results\": [{\"confidence\": 9, \"formatted\": \"Philippistraße 7, Münster\","
+        "\"geometry\": {\"lng\": 7.6325725, \"lat\": 51.9527557},"
+        "\"components\": {\"ISO_3166-1_alpha-3\": \"DEU\", \"ISO_3166-1_alpha-2\": \"DE\","
+        "\"road\": \"Philippistraße\", \"city\": \"Münster\", \"house_number\": \"7\"},"
+        "\"annotations\": {\"callingcode\": 49, \"timezone\": {\"offset_sec\": 7200,"
+        "\"now_in_dst\": 1, \"name\": \"Europe/Berlin\"}}}]}";
+    TEST("Testing parsing a canned reply", ocgeo_response_parse(canned, &response) &&
+        response.total_results == 1 && response.results[0].confidence == 9 &&
+        d_eq_7(response.results[0].geometry.lat, 51.9527557) &&
+        strcmp(response.results[0].ISO_alpha2, "DE") == 0 &&
+        strcmp(response.results[0].ISO_alpha3, "DEU") == 0 &&
+        strcmp(response.results[0].city, "Münster") == 0 &&
+        response.results[0].country == NULL && response.results[0].bounds == NULL &&
+        response.results[0].callingcode == 49 && response.results[0].timezone != NULL &&
+        response.results[0].timezone->now_in_dst &&
+        strcmp(response.results[0].timezone->name, "Europe/Berlin") == 0);
+    ocgeo_path_t* tz_path = ocgeo_path_compile("annotations.timezone.offset_sec");
+    ocgeo_path_t* missing_path = ocgeo_path_compile("components.country");
+    TEST("Testing adv API with compiled paths", tz_path != NULL && missing_path != NULL &&
+        ocgeo_path_get_int(&response.results[0], tz_path, &ok) == 7200 && ok &&
+        ocgeo_path_get_str(&response.results[0], missing_path, &ok) == NULL && !ok);
+    ocgeo_path_free(tz_path);
+    ocgeo_path_free(missing_path);
+    const char* value_paths[] = {"annotations.timezone.name", "annotations.timezone.now_in_dst",
+        "annotations.timezone", "annotations.callingcode", "components.country", "geometry.lat"};
+    ocgeo_path_t* compiled[6];
+    ocgeo_value_t values[6];
+    for (int i = 0; i < 6; ++i)
+        compiled[i] = ocgeo_path_compile(value_paths[i]);
+    TEST("Testing adv API, getting many values at once",
+        ocgeo_path_get_values(&response.results[0], (const ocgeo_path_t**) compiled, 6, values) == 5 &&
+        values[0].type == OCGEO_VALUE_STRING && strcmp(values[0].str, "Europe/Berlin") == 0 &&
+        values[1].type == OCGEO_VALUE_NUMBER && values[1].integer == 1 &&
+        values[2].type == OCGEO_VALUE_OTHER && values[3].integer == 49 &&
+        values[4].type == OCGEO_VALUE_MISSING && d_eq_7(values[5].dbl, 51.9527557));
+    for (int i = 0; i < 6; ++i)
+        ocgeo_path_free(compiled[i]);
+    TEST("Testing compacting a response", ocgeo_response_compact(&response) &&
+        response.total_results == 1 && strcmp(response.status.message, "OK") == 0 &&
+        strcmp(response.results[0].formatted, "Philippistraße 7, Münster") == 0 &&
+        strcmp(response.results[0].house_number, "7") == 0 &&
+        d_eq_7(response.results[0].geometry.lng, 7.6325725) &&
+        strcmp(response.results[0].timezone->name, "Europe/Berlin") == 0 &&
+        response.results[0].timezone->offset_sec == 7200 &&
+        ocgeo_response_get_str(&response.results[0], "components.city", &ok) == NULL && !ok);
+    ocgeo_response_reset(&response);
+    TEST("Testing response reset", response.total_results == 0 && response.results == NULL &&
+        response.status.code == 0);
+    ocgeo_response_cleanup(&response);
+    /* The numbers should be parsed exactly as strtod does, whatever their precision */
+    enum { COORDS = 2000 };
+    char* coords_reply = malloc(COORDS * 80 + 100);
+    char* coords = malloc(COORDS * 32);
+    int len = sprintf(coords_reply, "{\"status\": {\"code\": 200, \"message\": \"OK\"}, "
+        "\"total_results\": %d, \"results\": [", COORDS / 2);
+    srand(1);
+    for (int i = 0; i < COORDS; ++i) {
+        double coord = rand() / (double) RAND_MAX * 360.0 - 180.0;
+        sprintf(coords + 32 * i, i % 3 ? "%.*f" : "%.*e", i % 17, coord);
+    }
+    for (int i = 0; i < COORDS; i += 2)
+        len += sprintf(coords_reply + len, "%s{\"geometry\": {\"lat\": %s, \"lng\": %s}}",
+            i ? ", " : "", coords + 32 * i, coords + 32 * (i + 1));
+    strcpy(coords_reply + len, "]}");
+    bool exact = ocgeo_response_parse(coords_reply, &response);
+    for (int i = 0; exact && i < COORDS; i += 2)
+        exact = response.results[i / 2].geometry.lat == strtod(coords + 32 * i, NULL) &&
+            response.results[i / 2].geometry.lng == strtod(coords + 32 * (i + 1), NULL);
+    TEST("Testing parsing of coordinates", exact);
+    ocgeo_response_cleanup(&response);
+    free(coords_reply);
+    free(coords);
+    char country_code[] = "de";
+    const char* interned = ocgeo_intern("de");
+    TEST("Testing interned strings", interned != NULL && strcmp(interned, "de") == 0 &&
+        ocgeo_intern(country_code) == interned && ocgeo_intern("DE") != interned);
+
+    TEST("Testing parsing an invalid reply",
+        !ocgeo_response_parse("{\"status\": {\"code\": 200, \"message\": [\"OK\"", &response) &&
+        response.error.stage == OCGEO_ERROR_PARSE);
+    ocgeo_response_cleanup(&response);
+    ocgeo_response_parse("{\"status\": {\"code\": 200}, \"total_results\": 1, \"results\": [x]}", &response);
+    TEST("Testing the offset of a parse error", response.error.stage == OCGEO_ERROR_PARSE &&
+        response.error.offset == 58);
+    ocgeo_response_cleanup(&response);
+    TEST("Testing parsing a reply without status",
+        !ocgeo_response_parse("{\"total_results\": 1, \"results\": []}", &response) &&
+        response.error.stage == OCGEO_ERROR_SCHEMA);
+    ocgeo_response_cleanup(&response);
+
+    TEST("Testing compacting a missing disk cache", !ocgeo_disk_cache_compact("ocgeo_tests_missing", 0) &&
+        ocgeo_disk_cache_open("ocgeo_tests_missing", 0) == NULL);
+
+    ocgeo_rate_limiter_t* rl = ocgeo_rate_limiter_new(1, 2);
+    TEST("Testing rate limiter burst", ocgeo_rate_limiter_acquire(rl, false) &&
+        ocgeo_rate_limiter_acquire(rl, false) && !ocgeo_rate_limiter_acquire(rl, false));
+    ocgeo_rate_info_t quota = {.limit = 2500, .remaining = 0, .reset = time(NULL) + 3600};
+    ocgeo_rate_limiter_update(rl, &quota);
+    TEST("Testing rate limiter with exhausted quota", !ocgeo_rate_limiter_acquire(rl, true));
+    params.rate_limiter = rl;
+    ocgeo_forward(query, "6d0e711d72d74daeb2b0bfd2a5cdfdba", &params, &response);
+    TEST("Testing request rate limited by the client", response.status.code == OCGEO_CODE_RATE_LIMITED);
+    ocgeo_response_cleanup(&response);
+    params.rate_limiter = NULL;
+    ocgeo_rate_limiter_free(rl);
+
     TEST_DEC_TO_DEG(-10.1245839, -10, 7, 28.5);
     TEST_DEC_TO_DEG(-89.5006900, -89, 30, 2.48);
     TEST_DEC_TO_DEG(32.8247971, 32, 49, 29.27);
@@ -106,6 +1117,26 @@ int main(int argc, char* argv[])
     TEST_DEG_TO_DEC(-10.1245839);
     TEST_DEG_TO_DEC(-89.5006900);
 
+    if (start_standin_server()) {
+        test_client();
+        test_batch();
+        test_http2();
+        test_rate_limiter();
+        test_retries();
+        test_timeouts();
+        test_hedging();
+        test_compression();
+        test_streaming_parse();
+        test_cache();
+        test_disk_cache();
+        test_body_callback();
+        test_field_projection();
+        stop_standin_server();
+    }
+    else {
+        printf("SKIP the tests with the stand-in server, it could not be started\n");
+    }
+
     printf("\n%d failed, %d pass\n", count_fail, count_pass);
     return 0;
 }